@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include "CompiledLSystem.hpp"
+#include "Turtle.hpp"
+
+
+// How the branch depth of the turtle changes over a sequence of symbols, relative to where it starts.
+// A sequence is balanced (its net effect on the turtle is a rigid transform) when
+// it ends at the depth it started at and never pops below it.
+struct BracketProfile {
+    std::int64_t net{0};
+    std::int64_t max{0};
+    std::int64_t min{0};
+
+    bool IsBalanced() const { return net == 0 && min == 0; }
+
+    // First this, then `next`
+    void Append(const BracketProfile& next) {
+        max = std::max(max, net + next.max);
+        min = std::min(min, net + next.min);
+        net += next.net;
+    }
+};
+
+
+// Turtle rule index of every symbol id of the L-system
+template <typename SymbolType>
+std::vector<std::uint32_t> RulesOfSymbols(const CompiledLSystem<SymbolType>& lsystem, const Turtle<SymbolType>& turtle) {
+    std::vector<std::uint32_t> rule_of_symbol;
+    for (std::size_t id = 0; id < lsystem.getSymbolCount(); id++) {
+        rule_of_symbol.push_back(turtle.RuleIndexFromSymbol(lsystem.getSymbol(static_cast<std::uint32_t>(id))));
+    }
+    return rule_of_symbol;
+}
+
+// Bracket profile of every (symbol, remaining depth), built bottom up from the productions.
+// Indexed as profiles[depth][symbol id], for depth 0 up to and including `generation`.
+template <typename SymbolType>
+std::vector<std::vector<BracketProfile>> BracketProfiles(const CompiledLSystem<SymbolType>& lsystem,
+                                                         const Turtle<SymbolType>& turtle,
+                                                         const std::size_t generation) {
+    const std::vector<std::uint32_t> rule_of_symbol = RulesOfSymbols(lsystem, turtle);
+    std::vector<std::vector<BracketProfile>> profiles(generation + 1,
+                                                      std::vector<BracketProfile>(lsystem.getSymbolCount()));
+
+    // Depth 0, every symbol is interpreted as is (push first, like `Turtle::Apply`)
+    for (std::size_t id = 0; id < lsystem.getSymbolCount(); id++) {
+        if (rule_of_symbol[id] == Turtle<SymbolType>::no_rule) {
+            continue;
+        }
+        const CompiledDrawRule& draw_rule = turtle.getCompiledRule(rule_of_symbol[id]);
+        if (draw_rule.push_fifo) {
+            profiles[0][id].Append({1, 1, 0});
+        }
+        if (draw_rule.pop_fifo) {
+            profiles[0][id].Append({-1, 0, -1});
+        }
+    }
+
+    for (std::size_t depth = 1; depth <= generation; depth++) {
+        for (std::uint32_t id = 0; id < lsystem.getSymbolCount(); id++) {
+            if (!lsystem.HasProduction(id)) {
+                profiles[depth][id] = profiles[depth - 1][id];
+                continue;
+            }
+            for (auto child = lsystem.SuccessorBegin(id); child != lsystem.SuccessorEnd(id); child++) {
+                profiles[depth][id].Append(profiles[depth - 1][*child]);
+            }
+        }
+    }
+    return profiles;
+}
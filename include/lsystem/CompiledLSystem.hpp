@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "LSystemInterpreter.hpp"
+
+
+// The productions of an L-system as integer tables.
+// Every symbol gets a dense id, every successor becomes a run of ids in one flat array.
+// Walking the derivation tree then needs no hashing and no copies of successors,
+// which is what the streaming and per-(symbol, depth) algorithms are built on.
+template <typename SymbolType>
+class CompiledLSystem {
+public:
+    using SymbolId = std::uint32_t;
+
+    CompiledLSystem() = default;
+    explicit CompiledLSystem(const LSystemInterpreter<SymbolType>& lsystem);
+
+    std::size_t getSymbolCount() const { return symbols.size(); }
+    const SymbolType& getSymbol(const SymbolId id) const { return symbols[id]; }
+    const std::vector<SymbolId>& getAxiom() const { return axiom; }
+
+    // Throws std::invalid_argument for symbols that are not part of the L-system
+    SymbolId IdFromSymbol(const SymbolType& symbol) const;
+
+    // Symbols without a production (or with an identity production A -> A)
+    // expand to themselves, whatever the depth
+    bool HasProduction(const SymbolId id) const { return has_production[id] != 0; }
+    const SymbolId* SuccessorBegin(const SymbolId id) const { return successors.data() + successor_begin[id]; }
+    const SymbolId* SuccessorEnd(const SymbolId id) const { return successors.data() + successor_end[id]; }
+
+    // Calls `visitor(id)` for every symbol of the given generation, in order, without ever building
+    // the generation: the derivation tree is expanded depth first, one frame per level.
+    // Generation 0 is the axiom, generation N is what N calls of LSystemInterpreter::operator() give.
+    template <typename Visitor>
+    void Expand(std::size_t generation, Visitor&& visitor) const;
+
+private:
+    SymbolId Intern(const SymbolType& symbol);
+
+    std::vector<SymbolType> symbols;
+    std::unordered_map<SymbolType, SymbolId> ids;
+    std::vector<SymbolId> axiom;
+
+    std::vector<SymbolId> successors;
+    std::vector<std::size_t> successor_begin;
+    std::vector<std::size_t> successor_end;
+    std::vector<char> has_production;
+};
+
+
+template<typename SymbolType>
+typename CompiledLSystem<SymbolType>::SymbolId CompiledLSystem<SymbolType>::Intern(const SymbolType& symbol) {
+    const auto [id_iter, inserted] = this->ids.emplace(symbol, static_cast<SymbolId>(this->symbols.size()));
+    if (inserted) {
+        this->symbols.push_back(symbol);
+        this->successor_begin.push_back(0);
+        this->successor_end.push_back(0);
+        this->has_production.push_back(0);
+    }
+    return id_iter->second;
+}
+
+template<typename SymbolType>
+CompiledLSystem<SymbolType>::CompiledLSystem(const LSystemInterpreter<SymbolType>& lsystem) {
+    for (const auto& symbol: lsystem.getAlphabet()) {
+        this->Intern(symbol);
+    }
+    for (const auto& symbol: lsystem.getAxiom()) {
+        this->axiom.push_back(this->Intern(symbol));
+    }
+
+    for (const auto& production: lsystem.getProductions()) {
+        const SymbolId predecessor = this->Intern(production.getPredecessor());
+        const auto successor = production.getSuccessor();
+        if (successor.size() == 1 && successor[0] == production.getPredecessor()) {
+            continue;  // Identity, same as no production
+        }
+
+        // Interning first, `successors` only holds ids
+        std::vector<SymbolId> successor_ids;
+        for (const auto& symbol: successor) {
+            successor_ids.push_back(this->Intern(symbol));
+        }
+        this->successor_begin[predecessor] = this->successors.size();
+        this->successors.insert(this->successors.end(), successor_ids.begin(), successor_ids.end());
+        this->successor_end[predecessor] = this->successors.size();
+        this->has_production[predecessor] = 1;
+    }
+}
+
+template<typename SymbolType>
+typename CompiledLSystem<SymbolType>::SymbolId CompiledLSystem<SymbolType>::IdFromSymbol(const SymbolType& symbol) const {
+    const auto id_iter = this->ids.find(symbol);
+    if (id_iter == this->ids.end()) {
+        throw std::invalid_argument("Symbol is not part of the L-system");
+    }
+    return id_iter->second;
+}
+
+template<typename SymbolType>
+template<typename Visitor>
+void CompiledLSystem<SymbolType>::Expand(const std::size_t generation, Visitor&& visitor) const {
+    struct Frame {
+        const SymbolId* next;
+        const SymbolId* end;
+        std::size_t depth;  // Remaining derivation steps for the symbols of this frame
+    };
+    std::vector<Frame> frames;
+    frames.reserve(generation + 1);
+    frames.push_back({this->axiom.data(), this->axiom.data() + this->axiom.size(), generation});
+
+    while (!frames.empty()) {
+        Frame& frame = frames.back();
+        if (frame.next == frame.end) {
+            frames.pop_back();
+            continue;
+        }
+        const SymbolId id = *frame.next++;
+        const std::size_t depth = frame.depth;
+        if (depth == 0 || !this->HasProduction(id)) {
+            visitor(id);
+            continue;
+        }
+        frames.push_back({this->SuccessorBegin(id), this->SuccessorEnd(id), depth - 1});
+    }
+}
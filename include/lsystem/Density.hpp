@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+#include "Turtle.hpp"
+#include "SegmentBuffer.hpp"
+#include "TurtleBounds.hpp"
+#include "Rasterizer.hpp"
+#include "Parallel.hpp"
+
+
+// How much line passes through every pixel, as a float per pixel, rows from top to bottom.
+// For generations where single lines don't mean anything any more, the image is made from this instead.
+struct DensityBuffer {
+    std::size_t width{0};
+    std::size_t height{0};
+    std::vector<float> density;
+
+    DensityBuffer() = default;
+    DensityBuffer(const std::size_t width, const std::size_t height):
+        width(width), height(height), density(width * height, 0.0f) { }
+
+    void Clear() { std::fill(density.begin(), density.end(), 0.0f); }
+
+    // Adds the length of the line (in pixels) that lies inside the buffer, spread over the pixels it crosses.
+    // The line is clipped to the buffer first, then walked in fixed point steps of at most one pixel.
+    void AddLine(const TurtleVector& start, const TurtleVector& end);
+};
+
+// Segment sink that puts turtle space segments into a density buffer through a view,
+// for generations that are only ever streamed (StreamingTurtle, DerivationTables::Expand)
+class DensitySink {
+public:
+    DensitySink(DensityBuffer& buffer, const TurtleView& view): buffer(buffer), view(view) { }
+
+    void operator()(const TurtleVector& start, const TurtleVector& end) {
+        buffer.AddLine(view.ToScreen(start), view.ToScreen(end));
+    }
+
+private:
+    DensityBuffer& buffer;
+    TurtleView view;
+};
+
+
+// Accumulates screen space lines into the buffer. Every thread fills a buffer of its own from a contiguous part
+// of the lines, the buffers are summed at the end, row blocks in parallel. A thread count of 0 uses every core.
+void AccumulateDensity(const SegmentBuffer& lines, DensityBuffer& buffer, unsigned thread_count = 0);
+
+// Same for anything that comes in parts: `fill(part, target)` adds part `part` to the buffer `target`.
+// Parts are dealt out to the threads in turn, every thread fills a buffer of its own, then they are summed.
+// For example the parts of `DerivationTables::SplitVisible` through a `DensitySink`, or ranges of a segment file.
+template <typename Fill>
+void AccumulateDensityParts(std::size_t part_count, DensityBuffer& buffer, unsigned thread_count, Fill&& fill);
+
+// Adds the partial buffers to `buffer`, row blocks in parallel
+void SumDensity(const std::vector<DensityBuffer>& partial, DensityBuffer& buffer, unsigned thread_count = 0);
+
+// Tone maps the density into a color between `background` (no line) and `ink` (the densest pixel), on a
+// log scale: log(1 + exposure * density) / log(1 + exposure * max density). Higher exposure brings out
+// sparse parts. The framebuffer gets the size of the buffer.
+void ToneMapDensity(const DensityBuffer& buffer, RasterColor background, RasterColor ink, float exposure,
+                    Framebuffer& framebuffer);
+
+
+template<typename Fill>
+void AccumulateDensityParts(const std::size_t part_count, DensityBuffer& buffer, unsigned thread_count, Fill&& fill) {
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+    const std::size_t chunk_count = std::max<std::size_t>(1, std::min<std::size_t>(thread_count, part_count));
+    std::vector<DensityBuffer> partial(chunk_count - 1, DensityBuffer(buffer.width, buffer.height));
+    ParallelFor(chunk_count, thread_count, [&](const std::size_t chunk) {
+        DensityBuffer& target = chunk == 0 ? buffer : partial[chunk - 1];
+        for (std::size_t part = chunk; part < part_count; part += chunk_count) {
+            fill(part, target);
+        }
+    });
+    SumDensity(partial, buffer, thread_count);
+}
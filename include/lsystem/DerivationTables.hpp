@@ -0,0 +1,612 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+#include "CompiledLSystem.hpp"
+#include "Turtle.hpp"
+#include "BracketProfile.hpp"
+#include "TurtleBounds.hpp"
+
+
+// One entry of a subtree: a child subtree (or a single symbol), placed relative to the parent's frame
+struct SubtreeItem {
+    std::uint32_t node{0};
+    TurtleTransform entry{};     // Turtle state right before the item, relative to the parent
+    TurtleTransform placement{}; // Where the item's geometry starts, differs from `entry` only for a pop
+    std::uint64_t segment_offset{0}; // Segments drawn by the parent before this item
+    std::uint64_t symbol_offset{0};  // Symbols of the parent's expansion before this item
+};
+
+// The expansion of a symbol after a given number of derivation steps.
+// Every occurrence of the same (symbol, remaining depth) draws the same geometry, up to where it starts,
+// so it only exists once. Larger subtrees consist of placed smaller ones.
+struct SubtreeNode {
+    std::uint32_t symbol{0};
+    std::size_t depth{0};
+    bool leaf{false}; // A single symbol, drawn by its own draw rule
+
+    // Balanced subtrees (see BracketProfile) move the turtle by a rigid transform
+    bool balanced{false};
+    TurtleTransform transform{};
+
+    std::uint64_t segment_count{0};
+    std::uint64_t length{0};     // Number of symbols in the expansion
+    bool draws{false};           // Leaves only, the symbol draws a line...
+    TurtleVector segment_end{};  // ...from (0, 0) to here, in the leaf's frame
+
+    // Extent of everything the subtree draws, in the subtree's own frame.
+    // The hull is exact under rigid transforms, the box is the hull's box.
+    std::vector<TurtleVector> hull;
+    TurtleBounds bounds;
+    // Stand-in for the whole subtree when it is too small to see: a line from (0, 0) to the farthest hull point
+    TurtleVector proxy_end{};
+
+    std::vector<SubtreeItem> items; // Empty for leaves
+};
+
+
+// Closest segment to a point, see `DerivationTables::PickSegment`
+struct SegmentPick {
+    std::uint64_t segment{0}; // Index in turtle order
+    std::uint64_t symbol{0};  // Index of the symbol that drew it, in the generation
+    TurtleVector start{};
+    TurtleVector end{};
+    float distance{0.0f};
+};
+
+
+// A subtree at its place in the generation, see `DerivationTables::SplitVisible`
+struct PlacedSubtree {
+    std::uint32_t node{0};
+    TurtleTransform world{};
+};
+
+
+// Per-(symbol, remaining depth) tables for one generation of an L-system.
+//
+// Geometry is built once per distinct subtree and the whole generation is a hierarchy of placed subtrees,
+// so memory grows with the number of distinct (symbol, depth) pairs instead of the number of segments.
+// `Expand` turns the hierarchy back into flat segments when those are needed.
+//
+// Subtrees whose expansion opens or closes branches of their parent (bracket symbols, or a
+// production like A -> [ B) are not rigid transforms. Single bracket symbols become leaves that operate
+// on the parent's branch stack, larger unbalanced subtrees are inlined into their parent.
+template <typename SymbolType>
+class DerivationTables {
+public:
+    // Throws std::invalid_argument if the generation closes a branch that was never opened
+    DerivationTables(const CompiledLSystem<SymbolType>& lsystem, const Turtle<SymbolType>& turtle,
+                     std::size_t generation, float size_multiplier = 1.0f);
+
+    std::size_t getGeneration() const { return generation; }
+    std::size_t getNodeCount() const { return nodes.size(); }
+    const SubtreeNode& getNode(const std::uint32_t index) const { return nodes[index]; }
+    // The axiom after `generation` steps, its items are relative to the turtle's starting state
+    const SubtreeNode& getRoot() const { return root; }
+    TurtleTransform getOrigin() const { return {0.0f, turtle.getOrigin(), 0}; }
+    std::uint64_t getSegmentCount() const { return root.segment_count; }
+    // Number of symbols in the generation
+    std::uint64_t getLength() const { return root.length; }
+
+    // Turtle state right before the symbol at `index` of the generation is interpreted, the same state
+    // `Turtle::Interpret` passes to its state visitor. Composes one transform per derivation step,
+    // the prefix is never interpreted. Throws std::invalid_argument if the index is past the end.
+    TurtleState StateAt(std::uint64_t index) const;
+
+    // Index of the symbol that drew the given segment (in turtle order), found the same way.
+    // Throws std::invalid_argument if the segment is past the end.
+    std::uint64_t SymbolOfSegment(std::uint64_t segment) const;
+
+    // Random access to a single segment (in turtle order) and the symbol that drew it,
+    // one transform per derivation step. Throws std::invalid_argument if the segment is past the end.
+    SegmentPick SegmentAt(std::uint64_t segment) const;
+
+    // Statistical preview: calls segment_sink(start, end) for `count` segments picked uniformly at random
+    // (with replacement) from the whole generation, in turtle order. Costs count * depth, the generation
+    // is never expanded. The same seed gives the same sample.
+    template <typename SegmentSink>
+    void SampleSegments(std::uint64_t count, std::uint64_t seed, SegmentSink&& segment_sink) const;
+
+    // Subtrees that contain the symbol at `index`, from a symbol of the axiom down to the symbol itself:
+    // the chain of productions that produced it. Subtrees that were inlined into their parent
+    // (see the class comment) don't show up. Throws std::invalid_argument if the index is past the end.
+    std::vector<std::uint32_t> DerivationPath(std::uint64_t index) const;
+
+    // Closest segment within `max_distance` of the point, only subtrees that can be that close are visited.
+    // Returns false if there is none.
+    bool PickSegment(const TurtleVector& point, float max_distance, SegmentPick& pick) const;
+
+    // Exact bounds of the whole generation, without interpreting it
+    TurtleBounds getBounds() const;
+    // Conservative bounds of a subtree placed at `world`, cheap enough to call for every visited subtree
+    TurtleBounds NodeBounds(std::uint32_t node, const TurtleTransform& world) const;
+
+    // Calls segment_sink(start, end) for every segment of the generation, in the same order as the turtle
+    template <typename SegmentSink>
+    void Expand(SegmentSink&& segment_sink) const;
+
+    // Same, for a single placed subtree
+    template <typename SegmentSink>
+    void ExpandNode(std::uint32_t node, const TurtleTransform& world, SegmentSink&& segment_sink) const;
+
+    // Like `Expand`, but subtrees that fall completely outside `view` are skipped without visiting them
+    template <typename SegmentSink>
+    void ExpandVisible(const TurtleBounds& view, SegmentSink&& segment_sink) const;
+
+    // Level of detail: same, but subtrees whose bounds are smaller than `min_extent` (in turtle units,
+    // e.g. one pixel divided by the view scale) are not expanded, they get a single proxy segment instead
+    template <typename SegmentSink>
+    void ExpandVisible(const TurtleBounds& view, float min_extent, SegmentSink&& segment_sink) const;
+
+    // Splits the visible part of the generation into at least `part_count` placed subtrees (fewer if there
+    // aren't that many), in turtle order, by opening up the subtree with the most segments until there are
+    // enough. Expanding the parts one after the other gives the same segments as `ExpandVisible`,
+    // expanding them on separate threads splits the work.
+    std::vector<PlacedSubtree> SplitVisible(const TurtleBounds& view, float min_extent, std::size_t part_count) const;
+
+    // `ExpandVisible` for one of the parts
+    template <typename SegmentSink>
+    void ExpandVisible(const PlacedSubtree& part, const TurtleBounds& view, float min_extent,
+                       SegmentSink&& segment_sink) const;
+
+private:
+    std::uint32_t BuildNode(std::uint32_t symbol, std::size_t depth);
+
+    // Calls visitor(item) for every item on the way from the root to the symbol at `index`
+    template <typename Visitor>
+    void WalkToSymbol(std::uint64_t index, Visitor&& visitor) const;
+    // Same, to the leaf that draws the given segment
+    template <typename Visitor>
+    void WalkToSegment(std::uint64_t segment, Visitor&& visitor) const;
+
+    void PickNode(std::uint32_t node, const TurtleTransform& world, std::uint64_t segment_offset,
+                  std::uint64_t symbol_offset, const TurtleVector& point, bool& found, SegmentPick& pick) const;
+    void ComputeExtent(SubtreeNode& node) const;
+
+    template <typename SegmentSink>
+    void ExpandVisibleNode(std::uint32_t node, const TurtleTransform& world, const TurtleBounds& view,
+                           float min_extent, SegmentSink&& segment_sink) const;
+
+    // Walks the children of `symbol` at `depth` in the frame of the node being built
+    void Simulate(std::uint32_t symbol, std::size_t depth, TurtleTransform& state,
+                  std::vector<TurtleTransform>& lifo, SubtreeNode& node);
+    void AddChild(std::uint32_t child, std::size_t depth, TurtleTransform& state,
+                  std::vector<TurtleTransform>& lifo, SubtreeNode& node);
+
+    bool IsLeaf(const std::uint32_t symbol, const std::size_t depth) const {
+        return depth == 0 || !lsystem.HasProduction(symbol);
+    }
+
+    CompiledLSystem<SymbolType> lsystem;
+    Turtle<SymbolType> turtle;
+    std::size_t generation{0};
+    float size_multiplier{1.0f};
+
+    std::vector<std::uint32_t> rule_of_symbol;
+    std::vector<std::vector<BracketProfile>> profiles;
+
+    std::vector<SubtreeNode> nodes;
+    std::vector<std::int64_t> node_of; // (depth * symbol count + symbol) -> index in nodes, -1 if not built
+    SubtreeNode root;
+};
+
+
+template<typename SymbolType>
+DerivationTables<SymbolType>::DerivationTables(const CompiledLSystem<SymbolType>& lsystem,
+                                               const Turtle<SymbolType>& turtle,
+                                               const std::size_t generation, const float size_multiplier):
+    lsystem(lsystem), turtle(turtle), generation(generation), size_multiplier(size_multiplier),
+    rule_of_symbol(RulesOfSymbols(lsystem, turtle)), profiles(BracketProfiles(lsystem, turtle, generation)),
+    node_of((generation + 1) * lsystem.getSymbolCount(), -1) {
+    TurtleTransform state{};
+    std::vector<TurtleTransform> lifo;
+    this->root.depth = generation;
+    for (const auto symbol: this->lsystem.getAxiom()) {
+        this->AddChild(symbol, generation, state, lifo, this->root);
+    }
+    this->ComputeExtent(this->root);
+}
+
+template<typename SymbolType>
+void DerivationTables<SymbolType>::ComputeExtent(SubtreeNode& node) const {
+    std::vector<TurtleVector> points;
+    if (node.leaf) {
+        if (node.draws) {
+            points = {{0.0f, 0.0f}, node.segment_end};
+        }
+    } else {
+        for (const auto& item: node.items) {
+            for (const auto& point: this->nodes[item.node].hull) {
+                points.push_back(item.placement.Then({0.0f, point, 0}).offset);
+            }
+        }
+    }
+    node.hull = ConvexHull(std::move(points));
+    float proxy_length = -1.0f;
+    for (const auto& point: node.hull) {
+        node.bounds.Add(point);
+        const float length = point.x * point.x + point.y * point.y;
+        if (length > proxy_length) {
+            proxy_length = length;
+            node.proxy_end = point;
+        }
+    }
+}
+
+template<typename SymbolType>
+TurtleBounds DerivationTables<SymbolType>::getBounds() const {
+    const TurtleTransform origin = this->getOrigin();
+    TurtleBounds bounds;
+    for (const auto& point: this->root.hull) {
+        bounds.Add(origin.Then({0.0f, point, 0}).offset);
+    }
+    return bounds;
+}
+
+template<typename SymbolType>
+TurtleBounds DerivationTables<SymbolType>::NodeBounds(const std::uint32_t node, const TurtleTransform& world) const {
+    return this->nodes[node].bounds.Transformed(world);
+}
+
+template<typename SymbolType>
+template<typename Visitor>
+void DerivationTables<SymbolType>::WalkToSymbol(std::uint64_t index, Visitor&& visitor) const {
+    if (index >= this->root.length) {
+        throw std::invalid_argument("Symbol index is past the end of the generation");
+    }
+    const SubtreeNode* node = &this->root;
+    do {
+        // Last item that starts at or before the index
+        const auto next = std::upper_bound(node->items.begin(), node->items.end(), index,
+                                           [](const std::uint64_t i, const SubtreeItem& item) {
+            return i < item.symbol_offset;
+        });
+        const SubtreeItem& item = *(next - 1);
+        visitor(item);
+        index -= item.symbol_offset;
+        node = &this->nodes[item.node];
+    } while (!node->leaf);
+}
+
+template<typename SymbolType>
+TurtleState DerivationTables<SymbolType>::StateAt(const std::uint64_t index) const {
+    TurtleTransform world = this->getOrigin();
+    this->WalkToSymbol(index, [&world](const SubtreeItem& item) {
+        world = world.Then(item.entry);
+    });
+
+    TurtleState state = world.ApplyTo({});
+    this->turtle.NormalizeHeading(state);
+    return state;
+}
+
+template<typename SymbolType>
+std::vector<std::uint32_t> DerivationTables<SymbolType>::DerivationPath(const std::uint64_t index) const {
+    std::vector<std::uint32_t> path;
+    this->WalkToSymbol(index, [&path](const SubtreeItem& item) {
+        path.push_back(item.node);
+    });
+    return path;
+}
+
+template<typename SymbolType>
+template<typename Visitor>
+void DerivationTables<SymbolType>::WalkToSegment(std::uint64_t segment, Visitor&& visitor) const {
+    if (segment >= this->root.segment_count) {
+        throw std::invalid_argument("Segment index is past the end of the generation");
+    }
+    const SubtreeNode* node = &this->root;
+    while (!node->leaf) {
+        // Last item that starts at or before the segment and draws something
+        auto item = std::upper_bound(node->items.begin(), node->items.end(), segment,
+                                     [](const std::uint64_t s, const SubtreeItem& item) {
+            return s < item.segment_offset;
+        }) - 1;
+        while (this->nodes[item->node].segment_count == 0) {
+            item--;
+        }
+        visitor(*item);
+        segment -= item->segment_offset;
+        node = &this->nodes[item->node];
+    }
+}
+
+template<typename SymbolType>
+std::uint64_t DerivationTables<SymbolType>::SymbolOfSegment(const std::uint64_t segment) const {
+    std::uint64_t symbol = 0;
+    this->WalkToSegment(segment, [&symbol](const SubtreeItem& item) {
+        symbol += item.symbol_offset;
+    });
+    return symbol;
+}
+
+template<typename SymbolType>
+SegmentPick DerivationTables<SymbolType>::SegmentAt(const std::uint64_t segment) const {
+    SegmentPick pick;
+    pick.segment = segment;
+    TurtleTransform world = this->getOrigin();
+    const SubtreeNode* leaf = &this->root;
+    this->WalkToSegment(segment, [&](const SubtreeItem& item) {
+        world = world.Then(item.placement);
+        pick.symbol += item.symbol_offset;
+        leaf = &this->nodes[item.node];
+    });
+    pick.start = world.offset;
+    pick.end = world.Then({0.0f, leaf->segment_end, 0}).offset;
+    return pick;
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::SampleSegments(const std::uint64_t count, const std::uint64_t seed,
+                                                  SegmentSink&& segment_sink) const {
+    if (this->root.segment_count == 0) {
+        return;
+    }
+    std::mt19937_64 random(seed);
+    std::uniform_int_distribution<std::uint64_t> uniform(0, this->root.segment_count - 1);
+    std::vector<std::uint64_t> picks(count);
+    for (auto& pick: picks) {
+        pick = uniform(random);
+    }
+    // Turtle order, like every other expansion
+    std::sort(picks.begin(), picks.end());
+    for (const auto segment: picks) {
+        const SegmentPick pick = this->SegmentAt(segment);
+        segment_sink(pick.start, pick.end);
+    }
+}
+
+template<typename SymbolType>
+bool DerivationTables<SymbolType>::PickSegment(const TurtleVector& point, const float max_distance,
+                                               SegmentPick& pick) const {
+    bool found = false;
+    pick.distance = max_distance;
+    const TurtleTransform origin = this->getOrigin();
+    for (const auto& item: this->root.items) {
+        this->PickNode(item.node, origin.Then(item.placement), item.segment_offset, item.symbol_offset,
+                       point, found, pick);
+    }
+    return found;
+}
+
+template<typename SymbolType>
+void DerivationTables<SymbolType>::PickNode(const std::uint32_t node_index, const TurtleTransform& world,
+                                            const std::uint64_t segment_offset, const std::uint64_t symbol_offset,
+                                            const TurtleVector& point, bool& found, SegmentPick& pick) const {
+    const SubtreeNode& node = this->nodes[node_index];
+    if (node.segment_count == 0) {
+        return;
+    }
+    // Nothing in a box that is further away than the best segment so far
+    const TurtleBounds bounds = this->NodeBounds(node_index, world);
+    const float box_x = std::max({bounds.min.x - point.x, 0.0f, point.x - bounds.max.x});
+    const float box_y = std::max({bounds.min.y - point.y, 0.0f, point.y - bounds.max.y});
+    if (box_x * box_x + box_y * box_y > pick.distance * pick.distance) {
+        return;
+    }
+
+    if (node.leaf) {
+        const TurtleVector start = world.offset;
+        const TurtleVector end = world.Then({0.0f, node.segment_end, 0}).offset;
+        const float length_x = end.x - start.x;
+        const float length_y = end.y - start.y;
+        const float t = std::clamp(((point.x - start.x) * length_x + (point.y - start.y) * length_y) /
+                                   (length_x * length_x + length_y * length_y), 0.0f, 1.0f);
+        const float distance = std::hypot(start.x + t * length_x - point.x, start.y + t * length_y - point.y);
+        if (distance < pick.distance || (!found && distance <= pick.distance)) {
+            pick = {segment_offset, symbol_offset, start, end, distance};
+            found = true;
+        }
+        return;
+    }
+    for (const auto& item: node.items) {
+        this->PickNode(item.node, world.Then(item.placement), segment_offset + item.segment_offset,
+                       symbol_offset + item.symbol_offset, point, found, pick);
+    }
+}
+
+template<typename SymbolType>
+std::uint32_t DerivationTables<SymbolType>::BuildNode(const std::uint32_t symbol, std::size_t depth) {
+    if (this->IsLeaf(symbol, depth)) {
+        depth = 0;  // Leaves look the same at any depth
+    }
+    const std::size_t key = depth * this->lsystem.getSymbolCount() + symbol;
+    if (this->node_of[key] >= 0) {
+        return static_cast<std::uint32_t>(this->node_of[key]);
+    }
+
+    SubtreeNode node;
+    node.symbol = symbol;
+    node.depth = depth;
+    node.leaf = depth == 0;
+    node.length = node.leaf ? 1 : 0;
+    node.balanced = this->profiles[depth][symbol].IsBalanced();
+
+    if (node.leaf) {
+        const std::uint32_t rule_index = this->rule_of_symbol[symbol];
+        if (rule_index != Turtle<SymbolType>::no_rule) {
+            const CompiledDrawRule& draw_rule = this->turtle.getCompiledRule(rule_index);
+            const float line_size = draw_rule.draw_line_size * this->size_multiplier;
+            node.transform = this->turtle.TransformFromRule(draw_rule, this->size_multiplier);
+            node.draws = line_size != 0.0f;
+            node.segment_count = node.draws ? 1 : 0;
+            node.segment_end = {line_size * sinf(draw_rule.turn_angle), -line_size * cosf(draw_rule.turn_angle)};
+        }
+    } else {
+        // Only balanced subtrees get built, unbalanced ones are inlined by `AddChild`
+        TurtleTransform state{};
+        std::vector<TurtleTransform> lifo;
+        this->Simulate(symbol, depth, state, lifo, node);
+        node.transform = state;
+    }
+    this->ComputeExtent(node);
+
+    this->nodes.push_back(std::move(node));
+    this->node_of[key] = static_cast<std::int64_t>(this->nodes.size() - 1);
+    return static_cast<std::uint32_t>(this->nodes.size() - 1);
+}
+
+template<typename SymbolType>
+void DerivationTables<SymbolType>::Simulate(const std::uint32_t symbol, const std::size_t depth, TurtleTransform& state,
+                                            std::vector<TurtleTransform>& lifo, SubtreeNode& node) {
+    for (auto child = this->lsystem.SuccessorBegin(symbol); child != this->lsystem.SuccessorEnd(symbol); child++) {
+        this->AddChild(*child, depth - 1, state, lifo, node);
+    }
+}
+
+template<typename SymbolType>
+void DerivationTables<SymbolType>::AddChild(const std::uint32_t child, const std::size_t depth, TurtleTransform& state,
+                                            std::vector<TurtleTransform>& lifo, SubtreeNode& node) {
+    const BracketProfile& profile = this->profiles[depth][child];
+    const bool leaf = this->IsLeaf(child, depth);
+
+    if (!profile.IsBalanced() && !leaf) {
+        this->Simulate(child, depth, state, lifo, node);
+        return;
+    }
+
+    // Built first, building may grow `nodes`
+    const std::uint32_t child_node = this->BuildNode(child, depth);
+    const SubtreeNode& built = this->nodes[child_node];
+
+    SubtreeItem item{child_node, state, state, node.segment_count, node.length};
+    if (!profile.IsBalanced()) {
+        // Single bracket symbol, works on the stack of the node being built
+        const CompiledDrawRule& draw_rule = this->turtle.getCompiledRule(this->rule_of_symbol[child]);
+        if (draw_rule.push_fifo) {
+            lifo.push_back(state);
+        }
+        if (draw_rule.pop_fifo) {
+            if (lifo.empty()) {
+                throw std::invalid_argument("Generation closes a branch that was never opened");
+            }
+            state = lifo.back();
+            lifo.pop_back();
+        }
+        item.placement = state;
+    }
+    state = state.Then(built.transform);
+    node.segment_count += built.segment_count;
+    node.length += built.length;
+    node.items.push_back(item);
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::ExpandNode(const std::uint32_t node_index, const TurtleTransform& world,
+                                              SegmentSink&& segment_sink) const {
+    const SubtreeNode& node = this->nodes[node_index];
+    if (node.leaf) {
+        if (node.draws) {
+            const TurtleTransform end = world.Then({0.0f, node.segment_end, 0});
+            segment_sink(world.offset, end.offset);
+        }
+        return;
+    }
+    for (const auto& item: node.items) {
+        this->ExpandNode(item.node, world.Then(item.placement), segment_sink);
+    }
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::Expand(SegmentSink&& segment_sink) const {
+    const TurtleTransform origin = this->getOrigin();
+    for (const auto& item: this->root.items) {
+        this->ExpandNode(item.node, origin.Then(item.placement), segment_sink);
+    }
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::ExpandVisibleNode(const std::uint32_t node_index, const TurtleTransform& world,
+                                                     const TurtleBounds& view, const float min_extent,
+                                                     SegmentSink&& segment_sink) const {
+    const TurtleBounds bounds = this->NodeBounds(node_index, world);
+    if (!bounds.Intersects(view)) {
+        return;
+    }
+    const SubtreeNode& node = this->nodes[node_index];
+    if (node.leaf) {
+        this->ExpandNode(node_index, world, segment_sink);
+        return;
+    }
+    if (std::max(bounds.Width(), bounds.Height()) < min_extent) {
+        segment_sink(world.offset, world.Then({0.0f, node.proxy_end, 0}).offset);
+        return;
+    }
+    for (const auto& item: node.items) {
+        this->ExpandVisibleNode(item.node, world.Then(item.placement), view, min_extent, segment_sink);
+    }
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::ExpandVisible(const TurtleBounds& view, SegmentSink&& segment_sink) const {
+    this->ExpandVisible(view, 0.0f, segment_sink);
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::ExpandVisible(const TurtleBounds& view, const float min_extent,
+                                                 SegmentSink&& segment_sink) const {
+    const TurtleTransform origin = this->getOrigin();
+    for (const auto& item: this->root.items) {
+        this->ExpandVisibleNode(item.node, origin.Then(item.placement), view, min_extent, segment_sink);
+    }
+}
+
+template<typename SymbolType>
+std::vector<PlacedSubtree> DerivationTables<SymbolType>::SplitVisible(const TurtleBounds& view, const float min_extent,
+                                                                      const std::size_t part_count) const {
+    // Leaves and subtrees below the level of detail can't be split, `ExpandVisibleNode` handles them whole
+    const auto splittable = [&](const PlacedSubtree& part) {
+        const SubtreeNode& node = this->nodes[part.node];
+        const TurtleBounds bounds = this->NodeBounds(part.node, part.world);
+        return !node.leaf && std::max(bounds.Width(), bounds.Height()) >= min_extent;
+    };
+    const auto add_visible = [&](const SubtreeNode& parent, const TurtleTransform& world,
+                                 std::vector<PlacedSubtree>& parts) {
+        for (const auto& item: parent.items) {
+            const PlacedSubtree part{item.node, world.Then(item.placement)};
+            if (this->nodes[part.node].segment_count != 0 && this->NodeBounds(part.node, part.world).Intersects(view)) {
+                parts.push_back(part);
+            }
+        }
+    };
+
+    std::vector<PlacedSubtree> parts;
+    add_visible(this->root, this->getOrigin(), parts);
+    while (parts.size() < part_count) {
+        auto largest = parts.end();
+        for (auto part = parts.begin(); part != parts.end(); part++) {
+            if (splittable(*part) && (largest == parts.end() ||
+                                      this->nodes[part->node].segment_count > this->nodes[largest->node].segment_count)) {
+                largest = part;
+            }
+        }
+        if (largest == parts.end()) {
+            break;
+        }
+        // The children take the place of their parent, the order stays the turtle's
+        std::vector<PlacedSubtree> children;
+        add_visible(this->nodes[largest->node], largest->world, children);
+        const auto position = parts.erase(largest);
+        parts.insert(position, children.begin(), children.end());
+    }
+    return parts;
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void DerivationTables<SymbolType>::ExpandVisible(const PlacedSubtree& part, const TurtleBounds& view,
+                                                 const float min_extent, SegmentSink&& segment_sink) const {
+    this->ExpandVisibleNode(part.node, part.world, view, min_extent, segment_sink);
+}
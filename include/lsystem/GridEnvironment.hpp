@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "Turtle.hpp"
+
+
+// Spatial environment for open L-systems.
+// Space is divided in square cells, every cell counts how much "stuff" occupies it.
+// There are two layers:
+//  - obstacles, placed once by the user, these survive `ClearSegments`
+//  - segments, the plant itself, these are re-added after every derivation step
+// Queries are answered by looking at the cell a small distance in front of the turtle,
+// so the segment the turtle just drew does not count as a collision with itself.
+class GridEnvironment {
+public:
+    GridEnvironment() = default;
+    GridEnvironment(const TurtleVector& grid_origin, float cell_size, std::size_t columns, std::size_t rows,
+                    float probe_distance);
+
+    void ClearSegments();
+    void AddObstacle(const TurtleVector& min, const TurtleVector& max);
+    void AddSegment(const TurtleVector& start, const TurtleVector& end);
+
+    // Occupancy of the cell in front of the given turtle state.
+    // Anything outside the grid counts as occupied, the plant should not grow out of its world.
+    float Query(const TurtleState& state) const;
+
+    // Answers all queries of one derivation step at once
+    void QueryBatch(const std::vector<TurtleState>& states, std::vector<float>& values) const;
+
+    std::size_t getColumns() const { return columns; }
+    std::size_t getRows() const { return rows; }
+
+private:
+    // Returns false if the position is outside the grid
+    bool CellFromPosition(const TurtleVector& position, std::size_t& cell) const;
+
+    TurtleVector grid_origin{};
+    float cell_size{1.0f};
+    std::size_t columns{0};
+    std::size_t rows{0};
+    float probe_distance{0.0f};
+
+    std::vector<std::uint32_t> obstacles;
+    std::vector<std::uint32_t> segments;
+};
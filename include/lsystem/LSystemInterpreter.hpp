@@ -108,6 +108,16 @@ public:
     // and the middle B by A)
     std::vector<SymbolType> operator() () const;
 
+    // Replaces the accumulated internal state, the next call to `operator()`
+    // continues from the given state.
+    // Open L-systems use this to feed the environment's answers back into the derivation.
+    void setCurrentState(const std::vector<SymbolType>& state) { currentState = state; }
+    const std::vector<SymbolType>& getCurrentState() const { return currentState; }
+
+    const std::vector<SymbolType>& getAxiom() const { return axiom; }
+    const std::unordered_set<Production<SymbolType>>& getProductions() const { return productions; }
+    const std::unordered_set<SymbolType>& getAlphabet() const { return alphabet; }
+
 private:
     std::vector<SymbolType> axiom;
     std::unordered_set<Production<SymbolType>> productions;
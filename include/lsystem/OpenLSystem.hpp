@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "LSystemInterpreter.hpp"
+#include "Turtle.hpp"
+#include "GridEnvironment.hpp"
+
+
+// An open L-system is an L-system that communicates with its environment.
+// The grammar contains a special query symbol (for example "?E"), after every
+// derivation step each query symbol is answered by the environment and
+// rewritten into whatever symbol the `response` function picks for that answer.
+// The next derivation step then continues from these answered symbols,
+// so productions can react to the environment (grow around obstacles, stop on collision...).
+//
+// One step costs a single rewrite, a single turtle pass and a single batch of queries:
+//  1. rewrite the current state with the productions
+//  2. interpret the result once with the turtle, every segment is added to the environment
+//     and the turtle state at every query symbol is remembered
+//  3. answer all remembered queries at once
+//  4. replace every query symbol with its response
+// Every part is linear in the length of the state, there is no round trip per symbol.
+template <typename SymbolType>
+class OpenLSystemInterpreter {
+public:
+    using ResponseFunction = std::function<SymbolType(float)>;
+
+    OpenLSystemInterpreter(
+        const LSystemInterpreter<SymbolType>& lsystem,
+        const Turtle<SymbolType>& turtle,
+        const SymbolType& query_symbol,
+        const GridEnvironment& environment,
+        const ResponseFunction& response
+    );
+
+    // Executes a single iteration of the open L-System,
+    // the returned state has all its queries answered.
+    std::vector<SymbolType> operator() ();
+
+    void reset();
+
+    const GridEnvironment& getEnvironment() const { return environment; }
+    GridEnvironment& getEnvironment() { return environment; }
+
+private:
+    LSystemInterpreter<SymbolType> lsystem;
+    Turtle<SymbolType> turtle;
+    SymbolType query_symbol;
+    GridEnvironment environment;
+    ResponseFunction response;
+
+    // Reused between steps to avoid reallocating
+    std::vector<std::size_t> query_indices;
+    std::vector<TurtleState> query_states;
+    std::vector<float> query_values;
+};
+
+
+template<typename SymbolType>
+OpenLSystemInterpreter<SymbolType>::OpenLSystemInterpreter(const LSystemInterpreter<SymbolType>& lsystem,
+                                                           const Turtle<SymbolType>& turtle,
+                                                           const SymbolType& query_symbol,
+                                                           const GridEnvironment& environment,
+                                                           const ResponseFunction& response):
+    lsystem(lsystem), turtle(turtle), query_symbol(query_symbol), environment(environment), response(response) {
+    if (!this->response) {
+        throw std::invalid_argument("Open L-system needs a response function");
+    }
+}
+
+template<typename SymbolType>
+void OpenLSystemInterpreter<SymbolType>::reset() {
+    this->lsystem.reset();
+    this->environment.ClearSegments();
+}
+
+template<typename SymbolType>
+std::vector<SymbolType> OpenLSystemInterpreter<SymbolType>::operator()() {
+    std::vector<SymbolType> result = this->lsystem();
+
+    // Single turtle pass, collecting the plant and all queries
+    this->environment.ClearSegments();
+    this->query_indices.clear();
+    this->query_states.clear();
+    this->turtle.Interpret(result, 1.0f,
+        [this](const TurtleVector& start, const TurtleVector& end) {
+            this->environment.AddSegment(start, end);
+        },
+        [this](std::size_t index, const SymbolType& symbol, const TurtleState& state) {
+            if (symbol == this->query_symbol) {
+                this->query_indices.push_back(index);
+                this->query_states.push_back(state);
+            }
+        }
+    );
+
+    // Answer all queries at once, after the whole plant is known
+    this->environment.QueryBatch(this->query_states, this->query_values);
+    for (std::size_t i = 0; i < this->query_indices.size(); i++) {
+        result[this->query_indices[i]] = this->response(this->query_values[i]);
+    }
+
+    this->lsystem.setCurrentState(result);
+    return result;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+
+// Number of threads to use when the caller didn't ask for a specific number
+inline unsigned DefaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls `work(index)` for every index in [0, count), spread over at most `thread_count` threads.
+// Thread t handles the indices t, t + thread_count, ... so the work should be split
+// in roughly equal parts by the caller. Runs on the calling thread if there's only one thread.
+template <typename Work>
+void ParallelFor(const std::size_t count, unsigned thread_count, Work&& work) {
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+    const auto used_threads = static_cast<unsigned>(std::min<std::size_t>(thread_count, count));
+    if (used_threads <= 1) {
+        for (std::size_t index = 0; index < count; index++) {
+            work(index);
+        }
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(used_threads - 1);
+    const auto run = [&work, count, used_threads](const unsigned thread_index) {
+        for (std::size_t index = thread_index; index < count; index += used_threads) {
+            work(index);
+        }
+    };
+    for (unsigned thread_index = 1; thread_index < used_threads; thread_index++) {
+        threads.emplace_back(run, thread_index);
+    }
+    run(0);
+    for (auto& thread: threads) {
+        thread.join();
+    }
+}
+
+// Runs `work(task, spawn)` for the root task and for every task spawned along the way,
+// `spawn(task)` may be called from inside `work` to add more tasks.
+// Every thread has its own queue: it takes its newest task first (depth first, good for the cache)
+// and, when its own queue is empty, steals the oldest task of another thread (usually the largest).
+template <typename Task, typename Work>
+void RunWorkStealing(const Task& root, unsigned thread_count, Work&& work) {
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<Queue> queues(thread_count);
+    std::atomic<std::size_t> pending{1};
+    queues[0].tasks.push_back(root);
+
+    const auto run = [&](const unsigned self) {
+        while (pending.load() > 0) {
+            Task task;
+            bool found = false;
+            for (unsigned offset = 0; offset < thread_count && !found; offset++) {
+                Queue& queue = queues[(self + offset) % thread_count];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) {
+                    continue;
+                }
+                if (offset == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                found = true;
+            }
+            if (!found) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            work(task, [&queues, &pending, self](const Task& child) {
+                // Counted before the parent finishes, so pending can't drop to zero too early
+                pending++;
+                std::lock_guard<std::mutex> lock(queues[self].mutex);
+                queues[self].tasks.push_back(child);
+            });
+            pending--;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned thread_index = 1; thread_index < thread_count; thread_index++) {
+        threads.emplace_back(run, thread_index);
+    }
+    run(0);
+    for (auto& thread: threads) {
+        thread.join();
+    }
+}
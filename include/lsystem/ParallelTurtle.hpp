@@ -0,0 +1,236 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+
+#include "Turtle.hpp"
+#include "SegmentBuffer.hpp"
+#include "Parallel.hpp"
+
+
+// Below this many symbols per thread, starting threads costs more than it saves
+constexpr std::size_t parallel_turtle_min_chunk = 1 << 14;
+// Branches shorter than this are drawn by whoever draws their parent
+constexpr std::size_t parallel_turtle_min_branch = 1 << 12;
+
+
+// Fills `segments` with the same segments as `Turtle::Interpret`, using several threads.
+//
+// Without branches, every symbol is a rigid transform of the turtle (see TurtleTransform),
+// so the turtle state at any point is a prefix "sum" of transforms. This is a three phase scan:
+//  1. every thread runs its chunk from the identity state, which gives the chunk's transform,
+//     and counts its segments
+//  2. a short sequential scan over the chunk totals gives every chunk its start state
+//     and the offset of its segments in the output
+//  3. every thread runs the normal turtle over its chunk, from its start state,
+//     writing straight into its own part of the output
+// Start states come from composed transforms, so they match the sequential turtle within float
+// tolerance. Inputs that use the branch stack go to `InterpretBranchParallel`.
+template <typename SymbolType>
+void InterpretParallel(const Turtle<SymbolType>& turtle, const std::vector<SymbolType>& input,
+                       float size_multiplier, SegmentBuffer& segments, unsigned thread_count = 0);
+
+// Fills `segments` with the same segments as `Turtle::Interpret`, drawing branches in parallel.
+//
+// A branch (from a push symbol up to its matching pop symbol) only depends on the turtle state
+// where it starts, whatever happens inside it is undone by the pop. So:
+//  1. one sequential pass matches the brackets and counts the segments inside every branch
+//     of at least `min_branch_size` symbols, this tells where every branch writes its output
+//  2. a task walks its part of the input with its own stack, when it meets a large branch it
+//     hands the branch (with its start state and output offset) to the work stealing scheduler
+//     and jumps straight to the matching pop
+// The output is identical to the sequential turtle, every task does the same arithmetic.
+// Like `Turtle::Interpret`, throws std::invalid_argument when a branch is closed that was never opened.
+template <typename SymbolType>
+void InterpretBranchParallel(const Turtle<SymbolType>& turtle, const std::vector<SymbolType>& input,
+                             float size_multiplier, SegmentBuffer& segments, unsigned thread_count = 0,
+                             std::size_t min_branch_size = parallel_turtle_min_branch);
+
+
+template<typename SymbolType>
+void InterpretParallel(const Turtle<SymbolType>& turtle, const std::vector<SymbolType>& input,
+                       const float size_multiplier, SegmentBuffer& segments, unsigned thread_count) {
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+    const std::size_t chunk_count = std::max<std::size_t>(1, std::min<std::size_t>(
+            thread_count, input.size() / parallel_turtle_min_chunk));
+    const std::size_t chunk_size = (input.size() + chunk_count - 1) / chunk_count;
+
+    const auto interpret_sequential = [&]() {
+        segments.Clear();
+        turtle.Interpret(input, size_multiplier, [&segments](const TurtleVector& start, const TurtleVector& end) {
+            segments.Add(start, end);
+        });
+    };
+    if (chunk_count == 1) {
+        interpret_sequential();
+        return;
+    }
+
+    // Phase 1, reduce every chunk
+    std::vector<TurtleTransform> chunk_transforms(chunk_count);
+    std::vector<std::size_t> chunk_segments(chunk_count, 0);
+    std::vector<char> chunk_has_branches(chunk_count, 0);
+    ParallelFor(chunk_count, thread_count, [&](const std::size_t chunk) {
+        const std::size_t begin = chunk * chunk_size;
+        const std::size_t end = std::min(input.size(), begin + chunk_size);
+        // Running the turtle from the identity state gives the chunk's transform,
+        // with exactly the same arithmetic (and direction table) as the sequential turtle
+        TurtleState local{};
+        std::size_t segment_count = 0;
+        const auto count_sink = [&segment_count](const TurtleVector&, const TurtleVector&) { segment_count++; };
+        TurtleStack lifo(0);  // Stays empty, chunks with branches stop right away
+        for (std::size_t index = begin; index < end; index++) {
+            const std::uint32_t rule_index = turtle.RuleIndexFromSymbol(input[index]);
+            if (rule_index == Turtle<SymbolType>::no_rule) {
+                continue;
+            }
+            const CompiledDrawRule& draw_rule = turtle.getCompiledRule(rule_index);
+            if (draw_rule.push_fifo || draw_rule.pop_fifo) {
+                chunk_has_branches[chunk] = 1;
+                return;
+            }
+            turtle.Apply(draw_rule, size_multiplier, local, lifo, count_sink);
+        }
+        chunk_transforms[chunk] = {local.angle, local.position, local.heading};
+        chunk_segments[chunk] = segment_count;
+    });
+    if (std::find(chunk_has_branches.begin(), chunk_has_branches.end(), 1) != chunk_has_branches.end()) {
+        InterpretBranchParallel(turtle, input, size_multiplier, segments, thread_count);
+        return;
+    }
+
+    // Phase 2, exclusive scan over the chunk totals
+    std::vector<TurtleState> chunk_states(chunk_count);
+    std::vector<std::size_t> chunk_offsets(chunk_count, 0);
+    TurtleState state{turtle.getOrigin(), 0.0f};
+    std::size_t offset = 0;
+    for (std::size_t chunk = 0; chunk < chunk_count; chunk++) {
+        chunk_states[chunk] = state;
+        chunk_offsets[chunk] = offset;
+        state = chunk_transforms[chunk].ApplyTo(state);
+        turtle.NormalizeHeading(state);
+        offset += chunk_segments[chunk];
+    }
+
+    // Phase 3, every chunk draws into its own range
+    segments.start_x.resize(offset);
+    segments.start_y.resize(offset);
+    segments.end_x.resize(offset);
+    segments.end_y.resize(offset);
+    ParallelFor(chunk_count, thread_count, [&](const std::size_t chunk) {
+        const std::size_t begin = chunk * chunk_size;
+        const std::size_t end = std::min(input.size(), begin + chunk_size);
+        TurtleState current = chunk_states[chunk];
+        std::size_t output = chunk_offsets[chunk];
+        const auto sink = [&segments, &output](const TurtleVector& start, const TurtleVector& end) {
+            segments.start_x[output] = start.x;
+            segments.start_y[output] = start.y;
+            segments.end_x[output] = end.x;
+            segments.end_y[output] = end.y;
+            output++;
+        };
+        TurtleStack lifo(0);  // Stays empty, there are no branches
+
+        for (std::size_t index = begin; index < end; index++) {
+            const std::uint32_t rule_index = turtle.RuleIndexFromSymbol(input[index]);
+            if (rule_index != Turtle<SymbolType>::no_rule) {
+                turtle.Apply(turtle.getCompiledRule(rule_index), size_multiplier, current, lifo, sink);
+            }
+        }
+    });
+}
+
+template<typename SymbolType>
+void InterpretBranchParallel(const Turtle<SymbolType>& turtle, const std::vector<SymbolType>& input,
+                             const float size_multiplier, SegmentBuffer& segments, const unsigned thread_count,
+                             const std::size_t min_branch_size) {
+    struct Branch {
+        std::size_t end{0};      // Index of the matching pop symbol
+        std::size_t segments{0}; // Segments drawn from the push symbol up to (not including) the pop
+    };
+    struct Region {
+        std::size_t begin{0};
+        std::size_t end{0};
+        TurtleState state{};
+        std::size_t output{0};
+    };
+
+    // Phase 1, bracket matching
+    std::unordered_map<std::size_t, Branch> large_branches;
+    std::vector<std::pair<std::size_t, std::size_t>> open_brackets;  // (index, segments before it)
+    std::size_t segment_count = 0;
+    std::size_t max_depth = 0;
+    for (std::size_t index = 0; index < input.size(); index++) {
+        const std::uint32_t rule_index = turtle.RuleIndexFromSymbol(input[index]);
+        if (rule_index == Turtle<SymbolType>::no_rule) {
+            continue;
+        }
+        const CompiledDrawRule& draw_rule = turtle.getCompiledRule(rule_index);
+        // Same order as `Apply`, push first. A symbol that does both only holds one more state
+        // for a moment, it doesn't open or close a branch.
+        if (draw_rule.push_fifo && draw_rule.pop_fifo) {
+            max_depth = std::max(max_depth, open_brackets.size() + 1);
+        } else if (draw_rule.push_fifo) {
+            open_brackets.emplace_back(index, segment_count);
+            max_depth = std::max(max_depth, open_brackets.size());
+        } else if (draw_rule.pop_fifo) {
+            if (open_brackets.empty()) {
+                throw std::invalid_argument("Input closes a branch that was never opened");
+            }
+            const auto [open_index, open_segments] = open_brackets.back();
+            open_brackets.pop_back();
+            if (index - open_index >= min_branch_size) {
+                large_branches[open_index] = {index, segment_count - open_segments};
+            }
+        }
+        if (draw_rule.draw_line_size * size_multiplier != 0.0f) {
+            segment_count++;
+        }
+    }
+
+    // Phase 2, draw regions
+    segments.start_x.resize(segment_count);
+    segments.start_y.resize(segment_count);
+    segments.end_x.resize(segment_count);
+    segments.end_y.resize(segment_count);
+
+    const Region root{0, input.size(), {turtle.getOrigin(), 0.0f}, 0};
+    RunWorkStealing(root, thread_count, [&](const Region& region, const auto& spawn) {
+        TurtleState current = region.state;
+        std::size_t output = region.output;
+        const auto sink = [&segments, &output](const TurtleVector& start, const TurtleVector& end) {
+            segments.start_x[output] = start.x;
+            segments.start_y[output] = start.y;
+            segments.end_x[output] = end.x;
+            segments.end_y[output] = end.y;
+            output++;
+        };
+        TurtleStack lifo(max_depth);
+
+        for (std::size_t index = region.begin; index < region.end; index++) {
+            const std::uint32_t rule_index = turtle.RuleIndexFromSymbol(input[index]);
+            if (rule_index == Turtle<SymbolType>::no_rule) {
+                continue;
+            }
+            const CompiledDrawRule& draw_rule = turtle.getCompiledRule(rule_index);
+
+            // The region's own opening bracket is drawn here, not handed off again
+            if (draw_rule.push_fifo && index != region.begin) {
+                const auto branch_iter = large_branches.find(index);
+                if (branch_iter != large_branches.end()) {
+                    const Branch& branch = branch_iter->second;
+                    spawn(Region{index, branch.end, current, output});
+                    // Continue as if the branch was drawn, only the push matters for what comes next
+                    output += branch.segments;
+                    lifo.push(current);
+                    index = branch.end - 1;
+                    continue;
+                }
+            }
+            turtle.Apply(draw_rule, size_multiplier, current, lifo, sink);
+        }
+    });
+}
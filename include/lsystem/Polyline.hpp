@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "Turtle.hpp"
+#include "SegmentBuffer.hpp"
+
+
+// Connected runs of segments, stored as points.
+// Polyline i consists of the points [begin[i], begin[i + 1]).
+struct PolylineBuffer {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<std::size_t> begin{0};
+
+    std::size_t Size() const { return begin.size() - 1; }
+    std::size_t PointCount() const { return x.size(); }
+    // Number of line pieces over all polylines
+    std::size_t SegmentCount() const { return PointCount() - Size(); }
+
+    void Clear() {
+        x.clear();
+        y.clear();
+        begin.assign(1, 0);
+    }
+
+    TurtleVector Point(const std::size_t index) const { return {x[index], y[index]}; }
+};
+
+
+// Segment sink that simplifies the turtle output while it comes in:
+//  - a segment that starts where the previous one ended continues the same polyline
+//  - a point is dropped while every point dropped since the last kept one stays within `tolerance`
+//    of the line from that kept point (the anchor) onwards, so chains like 1 -> 1 1 become a single piece
+//    and gentle curves keep enough points. The allowed directions from the anchor are tracked as a wedge.
+//  - pieces shorter than `tolerance` are skipped, the polyline still ends on the exact last point
+// Call `Finish` after the last segment.
+class PolylineBuilder {
+public:
+    PolylineBuilder(PolylineBuffer& polylines, float tolerance);
+
+    void operator()(const TurtleVector& start, const TurtleVector& end);
+    void Finish();
+
+private:
+    void AddPoint(const TurtleVector& point);
+    // Narrows the wedge to the directions that pass within `tolerance` of the point
+    void Constrain(const TurtleVector& point);
+
+    PolylineBuffer& polylines;
+    float tolerance{0.0f};
+
+    bool open{false};     // A polyline is being built
+    TurtleVector pen{};   // End of the last segment, may not be in the buffer yet
+
+    // Directions from the anchor (the point before the last one), as angles relative to `wedge_center`
+    float wedge_center{0.0f};
+    float wedge_low{0.0f};
+    float wedge_high{0.0f};
+    float reach{0.0f};    // Farthest dropped point from the anchor
+};
+
+// All of the above at once
+PolylineBuffer SimplifySegments(const SegmentBuffer& segments, float tolerance);
+
+// The pieces of the polylines as separate segments, for code that works on segments (culling, export)
+SegmentBuffer PolylinePieces(const PolylineBuffer& polylines);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "SegmentBuffer.hpp"
+
+
+struct RasterColor {
+    std::uint8_t r{0};
+    std::uint8_t g{0};
+    std::uint8_t b{0};
+    std::uint8_t a{255};
+};
+
+// RGBA image in memory, 4 bytes per pixel, rows from top to bottom
+struct Framebuffer {
+    std::size_t width{0};
+    std::size_t height{0};
+    std::vector<std::uint8_t> rgba;
+
+    Framebuffer() = default;
+    Framebuffer(std::size_t width, std::size_t height, RasterColor background);
+
+    std::uint8_t* Pixel(const std::size_t x, const std::size_t y) { return rgba.data() + 4 * (y * width + x); }
+    const std::uint8_t* Pixel(const std::size_t x, const std::size_t y) const { return rgba.data() + 4 * (y * width + x); }
+};
+
+
+// Draws lines in screen space into the framebuffer without a GPU, for example the lines a RecordingBackend
+// got from LSystemDrawing. `thickness` holds the width of every line in pixels, like the thickness
+// raylib gets. Lines have round ends and anti-aliased edges.
+//
+// The lines are first sorted into square tiles of `tile_size` pixels, then the tiles are drawn in parallel:
+// a tile belongs to one thread, so no pixel is shared. Inside a tile the lines are drawn in order,
+// the image doesn't depend on the number of threads. A thread count of 0 uses every core.
+void RasterizeLines(const SegmentBuffer& lines, const std::vector<float>& thickness, RasterColor color,
+                    Framebuffer& framebuffer, unsigned thread_count = 0, std::size_t tile_size = 64);
+
+// Renders an image of any size straight into a tiled TIFF (uncompressed RGBA, BigTIFF past 4 GB) without
+// ever holding the whole image: tiles are rendered in parallel, each from its own list of lines (see
+// `RasterizeLines`), and written to their place in the file as soon as they are done.
+// Memory stays at one tile per thread plus the line lists. `tile_size` has to be a multiple of 16.
+// Throws std::invalid_argument for a bad tile size, std::runtime_error if the file can't be written.
+void RenderTiledTIFF(const std::string& path, const SegmentBuffer& lines, const std::vector<float>& thickness,
+                     RasterColor color, RasterColor background, std::size_t width, std::size_t height,
+                     std::size_t tile_size = 256, unsigned thread_count = 0);
+
+// Binary PPM (P6), alpha is dropped.
+// Throws std::runtime_error if the file can't be written.
+void WritePPM(const std::string& path, const Framebuffer& framebuffer);
+// RGBA PNG. The pixel data is stored without compression, no zlib needed.
+// Throws std::runtime_error if the file can't be written.
+void WritePNG(const std::string& path, const Framebuffer& framebuffer);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "Turtle.hpp"
+#include "SegmentBuffer.hpp"
+
+
+// Render backends receive the lines of a drawing in screen space, through
+//     void Line(const TurtleVector& start, const TurtleVector& end, float thickness)
+//     void Clear()  // Start a new image, for drawings that build an image over several calls
+// The drawing code is templated on the backend, like the turtle is on its segment sink,
+// so swapping the backend costs nothing per line. The raylib backend lives with the visualiser,
+// the two below need no window or GPU: for tests, benchmarks and CI.
+
+// Throws every line away, only counts them
+struct NullBackend {
+    std::size_t line_count{0};
+
+    void Line(const TurtleVector&, const TurtleVector&, float) { line_count++; }
+    void Clear() { line_count = 0; }
+};
+
+// Keeps every line in memory
+struct RecordingBackend {
+    SegmentBuffer lines;
+    std::vector<float> thickness;
+
+    void Line(const TurtleVector& start, const TurtleVector& end, const float line_thickness) {
+        lines.Add(start, end);
+        thickness.push_back(line_thickness);
+    }
+
+    void Clear() {
+        lines.Clear();
+        thickness.clear();
+    }
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "Turtle.hpp"
+
+
+// Flat storage for the output of the turtle.
+// Structure of arrays: every coordinate has its own array, so passes that only
+// need part of a segment (bounds, culling, drawing) walk through contiguous floats.
+struct SegmentBuffer {
+    std::vector<float> start_x;
+    std::vector<float> start_y;
+    std::vector<float> end_x;
+    std::vector<float> end_y;
+
+    std::size_t Size() const { return start_x.size(); }
+    bool Empty() const { return start_x.empty(); }
+
+    void Clear() {
+        start_x.clear();
+        start_y.clear();
+        end_x.clear();
+        end_y.clear();
+    }
+
+    void Reserve(const std::size_t size) {
+        start_x.reserve(size);
+        start_y.reserve(size);
+        end_x.reserve(size);
+        end_y.reserve(size);
+    }
+
+    void Add(const TurtleVector& start, const TurtleVector& end) {
+        start_x.push_back(start.x);
+        start_y.push_back(start.y);
+        end_x.push_back(end.x);
+        end_y.push_back(end.y);
+    }
+
+    TurtleVector Start(const std::size_t index) const { return {start_x[index], start_y[index]}; }
+    TurtleVector End(const std::size_t index) const { return {end_x[index], end_y[index]}; }
+};
+
+
+// Runs the turtle into `segments` and records, for every segment, the index of the symbol that drew it.
+// 4 bytes per segment, enough to go from a picked segment back to the input.
+// Throws std::length_error for inputs with more symbols than 32 bit indices can name,
+// `DerivationTables::SymbolOfSegment` covers generations of any size.
+template <typename SymbolType>
+void InterpretWithProvenance(const Turtle<SymbolType>& turtle, const std::vector<SymbolType>& input,
+                             const float size_multiplier, SegmentBuffer& segments,
+                             std::vector<std::uint32_t>& symbol_of_segment) {
+    if (input.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::length_error("Input has too many symbols for 32 bit provenance");
+    }
+    segments.Clear();
+    symbol_of_segment.clear();
+    std::uint32_t current_symbol = 0;
+    turtle.Interpret(input, size_multiplier, [&](const TurtleVector& start, const TurtleVector& end) {
+        segments.Add(start, end);
+        symbol_of_segment.push_back(current_symbol);
+    }, [&current_symbol](const std::size_t index, const SymbolType&, const TurtleState&) {
+        current_symbol = static_cast<std::uint32_t>(index);
+    });
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <array>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+#include "Turtle.hpp"
+#include "TurtleBounds.hpp"
+#include "SegmentBuffer.hpp"
+
+
+// Binary interchange format for turtle output, so other tools don't have to run the turtle again.
+//
+// Little endian. A 64 byte header, then the segments as structure of arrays: start x, start y, end x, end y,
+// optionally followed by the index of the symbol that drew every segment (see `InterpretWithProvenance`).
+// Every array starts at a multiple of 64 bytes, so a mapped file can be used in place.
+//
+//   offset  size  field
+//        0     4  magic "LSEG"
+//        4     4  version (1)
+//        8     4  encoding (SegmentEncoding)
+//       12     4  flags (1 = provenance)
+//       16     8  segment count
+//       24    16  bounds, min x, min y, max x, max y
+//       40     8  offset of the first array
+//       48    16  reserved, zero
+//
+// Quantized coordinates are 16 bit steps between the bounds: min + q * (max - min) / 65535.
+enum class SegmentEncoding : std::uint32_t {
+    Float32 = 0,
+    Quantized16 = 1,
+};
+
+// The coordinate arrays of a segment file, in file order
+enum class SegmentArray : std::size_t {
+    StartX = 0,
+    StartY = 1,
+    EndX = 2,
+    EndY = 3,
+};
+
+
+// Writes a segment file while the segments come in, as a segment sink. The count and the bounds
+// go into the header first, `DerivationTables` knows both without expanding anything.
+// Each array gets a small buffer that is written to its place in the file when full.
+// Call `Finish` after the last segment.
+class SegmentFileWriter {
+public:
+    // Throws std::runtime_error if the file can't be opened
+    SegmentFileWriter(const std::string& path, std::uint64_t segment_count, const TurtleBounds& bounds,
+                      SegmentEncoding encoding = SegmentEncoding::Float32, bool provenance = false);
+
+    void operator()(const TurtleVector& start, const TurtleVector& end);
+    // With the index of the symbol that drew the segment, for files with provenance (0 without).
+    // Provenance is stored in 32 bits, throws std::overflow_error for a symbol index that doesn't fit.
+    // Both throw std::overflow_error for a segment past the count from the header, nothing is stored then.
+    void Add(const TurtleVector& start, const TurtleVector& end, std::uint64_t symbol);
+
+    // Throws std::invalid_argument if the number of segments isn't the one from the header,
+    // std::runtime_error if the file couldn't be written
+    void Finish();
+
+private:
+    void Store(std::size_t array, float value);
+    void FlushArrays();
+
+    std::string path;
+    std::ofstream file;
+    std::uint64_t segment_count{0};
+    TurtleBounds bounds;
+    SegmentEncoding encoding{SegmentEncoding::Float32};
+    bool provenance{false};
+
+    std::uint64_t written{0};  // Segments that came in
+    std::uint64_t flushed{0};  // Segments already in the file
+    std::array<std::vector<char>, 5> buffers;  // The four coordinate arrays and the provenance
+    std::array<std::uint64_t, 5> offsets{};
+};
+
+// All of a segment buffer at once. `symbol_of_segment` may be null, otherwise it needs one entry per segment.
+// Throws std::invalid_argument if it doesn't, std::runtime_error if the file can't be written.
+void WriteSegmentFile(const std::string& path, const SegmentBuffer& segments,
+                      SegmentEncoding encoding = SegmentEncoding::Float32,
+                      const std::vector<std::uint32_t>* symbol_of_segment = nullptr);
+
+
+// A segment file mapped into memory. Opening it only reads the header, the arrays are used
+// straight from the mapping (zero copy), so files of any size open in about the same time.
+class SegmentFile {
+public:
+    // Throws std::runtime_error if the file can't be mapped or isn't a valid segment file
+    explicit SegmentFile(const std::string& path);
+    ~SegmentFile();
+
+    SegmentFile(const SegmentFile&) = delete;
+    SegmentFile& operator=(const SegmentFile&) = delete;
+    SegmentFile(SegmentFile&& other) noexcept;
+    SegmentFile& operator=(SegmentFile&& other) noexcept;
+
+    std::uint64_t Size() const { return segment_count; }
+    const TurtleBounds& getBounds() const { return bounds; }
+    SegmentEncoding getEncoding() const { return encoding; }
+    bool HasProvenance() const { return provenance != nullptr; }
+
+    // The arrays in the file, null if the file has another encoding (or no provenance)
+    const float* FloatArray(SegmentArray array) const;
+    const std::uint16_t* QuantizedArray(SegmentArray array) const;
+    const std::uint32_t* Provenance() const { return provenance; }
+
+    // Decoded, for either encoding
+    TurtleVector Start(std::size_t index) const;
+    TurtleVector End(std::size_t index) const;
+
+    // Calls segment_sink(start, end) for every segment, in file order
+    template <typename SegmentSink>
+    void ForEach(SegmentSink&& segment_sink) const;
+    // Same for the segments [begin, end), ranges can be read on separate threads
+    template <typename SegmentSink>
+    void ForEach(std::size_t begin, std::size_t end, SegmentSink&& segment_sink) const;
+
+private:
+    float Coordinate(SegmentArray array, std::size_t index) const;
+    void Unmap();
+
+    const std::uint8_t* data{nullptr};
+    std::size_t size{0};
+#if defined(_WIN32)
+    void* file_handle{nullptr};
+    void* mapping_handle{nullptr};
+#endif
+
+    std::uint64_t segment_count{0};
+    TurtleBounds bounds;
+    SegmentEncoding encoding{SegmentEncoding::Float32};
+    std::array<const void*, 4> arrays{};
+    const std::uint32_t* provenance{nullptr};
+};
+
+
+template<typename SegmentSink>
+void SegmentFile::ForEach(SegmentSink&& segment_sink) const {
+    this->ForEach(0, this->segment_count, segment_sink);
+}
+
+template<typename SegmentSink>
+void SegmentFile::ForEach(std::size_t begin, const std::size_t end, SegmentSink&& segment_sink) const {
+    for (; begin < end; begin++) {
+        segment_sink(this->Start(begin), this->End(begin));
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "Turtle.hpp"
+#include "SegmentBuffer.hpp"
+#include "TurtleBounds.hpp"
+
+
+// Uniform grid over the boxes of the segments of a SegmentBuffer, to find the segments in a region
+// (the viewport) without looking at all of them.
+// Every cell lists the segments whose box overlaps it, all lists live in one flat array.
+// The grid stores indices only, the buffer has to outlive it and stay unchanged.
+class SegmentGrid {
+public:
+    SegmentGrid() = default;
+
+    // Sized for about `segments_per_cell` segments per cell, the cell lists are filled in parallel.
+    // A thread count of 0 uses every core.
+    void Build(const SegmentBuffer& segments, unsigned thread_count = 0, float segments_per_cell = 4.0f);
+
+    // Indices of every segment whose box intersects the region, each one once, in increasing order per cell
+    void Query(const TurtleBounds& region, std::vector<std::uint32_t>& indices) const;
+
+    // Segment closest to the point, if any lies within `max_distance`. Returns false if there is none.
+    bool Nearest(const TurtleVector& point, float max_distance, std::uint32_t& index) const;
+
+    std::size_t getColumns() const { return columns; }
+    std::size_t getRows() const { return rows; }
+    const TurtleBounds& getBounds() const { return bounds; }
+
+private:
+    struct CellRange {
+        std::size_t min_column, max_column, min_row, max_row;
+    };
+    // Cells that overlap the box, clamped to the grid
+    CellRange CellsOf(const TurtleBounds& box) const;
+    TurtleBounds SegmentBox(std::size_t index) const;
+
+    const SegmentBuffer* segments{nullptr};
+    TurtleBounds bounds;
+    std::size_t columns{0};
+    std::size_t rows{0};
+    float cell_width{1.0f};
+    float cell_height{1.0f};
+
+    std::vector<std::size_t> cell_begin;  // Cell c lists cell_indices[cell_begin[c], cell_begin[c + 1])
+    std::vector<std::uint32_t> cell_indices;
+};
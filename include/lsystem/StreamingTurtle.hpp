@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "CompiledLSystem.hpp"
+#include "Turtle.hpp"
+#include "BracketProfile.hpp"
+
+
+// Derives a generation and interprets it in one go, the symbols of the generation are never stored.
+// Symbols come out of `CompiledLSystem::Expand` one by one and go straight into the turtle,
+// so memory stays at one frame per derivation step plus the turtle's branch stack,
+// even for generations with billions of symbols.
+//
+// The branch stack can't be sized by looking at the input (there is none), instead it is sized
+// from the bracket profiles of the productions (see `BracketProfiles`).
+template <typename SymbolType>
+class StreamingTurtle {
+public:
+    StreamingTurtle(const CompiledLSystem<SymbolType>& lsystem, const Turtle<SymbolType>& turtle);
+
+    // Deepest branch nesting in the given generation.
+    // Throws std::invalid_argument if the generation closes a branch that was never opened.
+    std::size_t MaxBranchDepth(std::size_t generation) const;
+
+    // Same segments as deriving the generation and calling `Turtle::Interpret` on it
+    template <typename SegmentSink>
+    void Interpret(std::size_t generation, float size_multiplier, SegmentSink&& segment_sink) const;
+
+private:
+    CompiledLSystem<SymbolType> lsystem;
+    Turtle<SymbolType> turtle;
+    std::vector<std::uint32_t> rule_of_symbol;  // Turtle rule index for every symbol id
+};
+
+
+template<typename SymbolType>
+StreamingTurtle<SymbolType>::StreamingTurtle(const CompiledLSystem<SymbolType>& lsystem, const Turtle<SymbolType>& turtle):
+    lsystem(lsystem), turtle(turtle), rule_of_symbol(RulesOfSymbols(lsystem, turtle)) { }
+
+template<typename SymbolType>
+std::size_t StreamingTurtle<SymbolType>::MaxBranchDepth(const std::size_t generation) const {
+    const auto profiles = BracketProfiles(this->lsystem, this->turtle, generation);
+
+    BracketProfile total{};
+    for (const auto id: this->lsystem.getAxiom()) {
+        total.Append(profiles[generation][id]);
+    }
+    if (total.min < 0) {
+        throw std::invalid_argument("Generation closes a branch that was never opened");
+    }
+    return static_cast<std::size_t>(total.max);
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void StreamingTurtle<SymbolType>::Interpret(const std::size_t generation, const float size_multiplier,
+                                            SegmentSink&& segment_sink) const {
+    TurtleStack lifo(this->MaxBranchDepth(generation));
+    TurtleState current{this->turtle.getOrigin(), 0.0f};
+
+    this->lsystem.Expand(generation, [&](const std::uint32_t id) {
+        const std::uint32_t rule_index = this->rule_of_symbol[id];
+        if (rule_index != Turtle<SymbolType>::no_rule) {
+            this->turtle.Apply(this->turtle.getCompiledRule(rule_index), size_multiplier, current, lifo, segment_sink);
+        }
+    });
+}
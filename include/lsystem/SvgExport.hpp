@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "Turtle.hpp"
+#include "TurtleBounds.hpp"
+
+
+// What an SVG export wrote, see `SvgWriter::Finish`
+struct SvgStats {
+    std::uint64_t segments{0};   // Segments that came in
+    std::uint64_t pieces{0};     // Line pieces written, after stitching and merging
+    std::uint64_t polylines{0};
+    std::uint64_t bytes{0};      // Size of the file
+    double seconds{0.0};         // From construction to `Finish`
+};
+
+
+// Segment sink that streams the turtle output into an SVG file, for vector output of any size:
+//  - coordinates are snapped to multiples of `quantum` (turtle units) and written as integers,
+//    the view box is in the same units so no scaling is needed
+//  - a segment that starts where the previous one ended (within a quantum) continues the same polyline, written
+//    as relative steps; steps in the same direction are merged, zero length steps are dropped
+//  - the text goes through a fixed size buffer straight into the file, nothing grows with the output
+// `bounds` sets the view box and has to be known up front (`DerivationTables::getBounds` gives it
+// without expanding anything). Call `Finish` after the last segment.
+class SvgWriter {
+public:
+    // Throws std::invalid_argument for a quantum that isn't positive,
+    // std::runtime_error if the file can't be opened
+    SvgWriter(const std::string& path, const TurtleBounds& bounds, float quantum = 0.01f,
+              float stroke_width = 1.0f, const std::string& stroke = "#505050");
+
+    void operator()(const TurtleVector& start, const TurtleVector& end);
+
+    // Ends the document and closes the file. Throws std::runtime_error if the file couldn't be written.
+    SvgStats Finish();
+
+private:
+    void EndPolyline();
+    void FlushStep();
+    void Write(const char* text, std::size_t size);
+    void Write(const std::string& text) { Write(text.data(), text.size()); }
+    void WriteInteger(std::int64_t value);
+    void Flush();
+    std::int64_t Quantize(float value) const;
+
+    std::string path;
+    std::ofstream file;
+    std::vector<char> buffer;
+    std::size_t buffered{0};
+    float quantum{0.01f};
+    std::chrono::steady_clock::time_point begin;
+    SvgStats stats;
+
+    bool open{false};               // A polyline is being built
+    std::int64_t polyline_x{0};     // Quantized start of the polyline
+    std::int64_t polyline_y{0};
+    std::size_t polyline_pieces{0}; // Pieces of the polyline written so far
+    std::int64_t pen_x{0};          // Quantized end of the last segment
+    std::int64_t pen_y{0};
+    std::int64_t step_x{0};         // Step that may still grow by merging, not written yet
+    std::int64_t step_y{0};
+    std::size_t path_polylines{0};  // Polylines in the current path element
+};
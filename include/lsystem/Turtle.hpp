@@ -0,0 +1,423 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+
+
+// Point / direction in turtle space.
+// Has the same layout as raylib's Vector2, but the library itself
+// does not depend on raylib so the turtle can run headless
+// (tests, environment queries, offline rendering).
+struct TurtleVector {
+    float x{0};
+    float y{0};
+};
+
+// Everything the turtle needs to know to continue drawing,
+// this is also what gets saved when a branch is started.
+struct TurtleState {
+    TurtleVector position{};
+    float angle{0}; // In radians, 0 is pointing up
+    std::int32_t heading{0}; // Index in the direction table, only used when all turns are quantized
+};
+
+// The effect of a symbol (or a whole sequence without branches) on the turtle, as a rigid transform
+// relative to the turtle's own frame: first turn by `angle`, then move by `offset`,
+// where the offset is expressed as if the turtle was pointing up (angle 0).
+// Composing transforms is associative, which allows scanning them in parallel.
+struct TurtleTransform {
+    float angle{0};
+    TurtleVector offset{};
+    std::int32_t steps{0}; // Same turn in direction table steps, for quantized turtles
+
+    // First this, then `next`
+    TurtleTransform Then(const TurtleTransform& next) const {
+        const float sin_angle = sinf(angle);
+        const float cos_angle = cosf(angle);
+        return {
+            angle + next.angle,
+            {offset.x + cos_angle * next.offset.x - sin_angle * next.offset.y,
+             offset.y + sin_angle * next.offset.x + cos_angle * next.offset.y},
+            steps + next.steps
+        };
+    }
+
+    // Moves a turtle state by this transform, headings are left to the caller for quantized turtles
+    TurtleState ApplyTo(const TurtleState& state) const {
+        const float sin_angle = sinf(state.angle);
+        const float cos_angle = cosf(state.angle);
+        TurtleState result = state;
+        result.angle = state.angle + angle;
+        result.position = {state.position.x + cos_angle * offset.x - sin_angle * offset.y,
+                           state.position.y + sin_angle * offset.x + cos_angle * offset.y};
+        result.heading = state.heading + steps;
+        return result;
+    }
+};
+
+
+// Describes how the turtle should react to a single symbol.
+// Symbols without a rule are ignored by the turtle.
+template <typename SymbolType>
+struct DrawRuleStruct {
+    const SymbolType symbolType{};
+
+    float draw_line_size{0};
+    bool end_this_branch{false};
+    float turn_angle{0}; // Positive or negative angle, in radians
+
+    bool push_fifo{};
+    bool pop_fifo{};
+
+    // Only used by the 3D turtle, `turn_angle` is treated as extra yaw there
+    float yaw_angle{0};   // Around the turtle's up axis
+    float pitch_angle{0}; // Around the turtle's left axis
+    float roll_angle{0};  // Around the turtle's heading
+    float radius_scale{1}; // Multiplies the branch radius from this symbol on, for tapering
+};
+
+
+// Branch stack of the turtle.
+// One contiguous allocation, sized up front from the deepest branch in the input
+// (see `Turtle::MaxBranchDepth`), so pushing never allocates.
+// Callers that size it themselves have to count like `Apply` does, debug builds check it.
+class TurtleStack {
+public:
+    explicit TurtleStack(const std::size_t capacity): states(capacity) { }
+
+    void push(const TurtleState& state) {
+        assert(size < states.size());
+        states[size++] = state;
+    }
+    const TurtleState& top() const {
+        assert(size > 0);
+        return states[size - 1];
+    }
+    void pop() {
+        assert(size > 0);
+        size--;
+    }
+    bool empty() const { return size == 0; }
+
+private:
+    std::vector<TurtleState> states;
+    std::size_t size{0};
+};
+
+
+// Draw rule reduced to what the turtle loop needs:
+// no symbol to copy and nothing to compare, just a few floats and flags.
+struct CompiledDrawRule {
+    float draw_line_size{0};
+    float turn_angle{0};
+    std::int32_t turn_steps{0}; // Turn as a number of direction table steps, in [0, direction count)
+    bool end_this_branch{false};
+    bool push_fifo{false};
+    bool pop_fifo{false};
+};
+
+// Single byte symbols (char, or std::string of length 1, which is what all our grammars use)
+// are looked up in a 256 entry table instead of a hash map.
+template <typename SymbolType>
+struct SymbolByte {
+    static bool Get(const SymbolType&, unsigned char&) { return false; }
+};
+
+template <>
+struct SymbolByte<char> {
+    static bool Get(const char& symbol, unsigned char& byte) {
+        byte = static_cast<unsigned char>(symbol);
+        return true;
+    }
+};
+
+template <>
+struct SymbolByte<std::string> {
+    static bool Get(const std::string& symbol, unsigned char& byte) {
+        if (symbol.size() != 1) {
+            return false;
+        }
+        byte = static_cast<unsigned char>(symbol[0]);
+        return true;
+    }
+};
+
+
+// The turtle interprets a sequence of symbols as drawing instructions.
+// It does not draw anything itself, every line is handed to a "segment sink",
+// a callable with signature void(const TurtleVector& start, const TurtleVector& end).
+// This way the same turtle logic can feed raylib, an environment or a test.
+template <typename SymbolType>
+class Turtle {
+public:
+    Turtle() { byte_table.fill(no_rule); }
+    Turtle(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules, const TurtleVector& origin);
+
+    static constexpr std::uint32_t no_rule = UINT32_MAX;
+
+    // Returns nullptr if there is no rule for the given symbol
+    const DrawRuleStruct<SymbolType>* DrawruleFromSymbol(const SymbolType& symbol) const;
+
+    // Index into the compiled rules, or `no_rule` for symbols the turtle ignores
+    std::uint32_t RuleIndexFromSymbol(const SymbolType& symbol) const;
+    const CompiledDrawRule& getCompiledRule(std::uint32_t index) const { return compiled_rules[index]; }
+
+    // Deepest nesting of branches in the input, checked in the same pass.
+    // Throws std::invalid_argument when a branch is closed that was never opened,
+    // so a malformed input never reaches the drawing loop.
+    // Branches that are left open at the end are fine.
+    std::size_t MaxBranchDepth(const std::vector<SymbolType>& input) const;
+
+    // Transform of a single rule, ignoring its branch stack operations
+    TurtleTransform TransformFromRule(const CompiledDrawRule& draw_rule, float size_multiplier) const;
+
+    // Puts a state that was moved by transforms back on the direction table (heading modulo N,
+    // exact angle). Does nothing for turtles that aren't quantized.
+    void NormalizeHeading(TurtleState& state) const;
+
+    // Applies a single rule to the turtle state, every line drawn goes to the segment sink.
+    // `lifo` is the branch stack, anything with push/top/pop of TurtleState.
+    template <typename Stack, typename SegmentSink>
+    void Apply(const CompiledDrawRule& draw_rule, float size_multiplier, TurtleState& current,
+               Stack& lifo, SegmentSink&& segment_sink) const;
+
+    // Walk over the input once (after checking its branches with `MaxBranchDepth`).
+    // `state_visitor` is called with (symbol index, symbol, state) before every symbol is interpreted,
+    // it has signature void(std::size_t, const SymbolType&, const TurtleState&).
+    template <typename SegmentSink, typename StateVisitor>
+    void Interpret(const std::vector<SymbolType>& input, float size_multiplier,
+                   SegmentSink&& segment_sink, StateVisitor&& state_visitor) const;
+
+    template <typename SegmentSink>
+    void Interpret(const std::vector<SymbolType>& input, float size_multiplier, SegmentSink&& segment_sink) const;
+
+    const std::vector<DrawRuleStruct<SymbolType>>& getDrawRules() const { return draw_rules; }
+    TurtleVector getOrigin() const { return origin; }
+
+    // When every turn angle is a whole multiple of 2π / N (N up to `max_directions`) the turtle
+    // keeps its heading as an index in a table of N precomputed directions.
+    // No sin/cos while drawing, and the heading stays exact no matter how many turns add up.
+    static constexpr std::int32_t max_directions = 720;
+    bool IsQuantized() const { return quantized; }
+    std::size_t getDirectionCount() const { return directions.size(); }
+
+private:
+    std::vector<DrawRuleStruct<SymbolType>> draw_rules;
+    TurtleVector origin{};
+
+    // Dispatch tables, built once in the constructor.
+    // Both map a symbol to an index in `draw_rules` / `compiled_rules`.
+    std::vector<CompiledDrawRule> compiled_rules;
+    std::array<std::uint32_t, 256> byte_table{};
+    std::unordered_map<SymbolType, std::uint32_t> symbol_table;
+
+    // Direction table for quantized turns
+    struct Direction {
+        float sin{0};
+        float cos{1};
+        float angle{0};
+    };
+    bool quantized{false};
+    std::vector<Direction> directions;
+};
+
+
+template<typename SymbolType>
+Turtle<SymbolType>::Turtle(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules, const TurtleVector& origin):
+    draw_rules(draw_rules), origin(origin) {
+    this->byte_table.fill(no_rule);
+
+    for (std::size_t index = 0; index < this->draw_rules.size(); index++) {
+        const auto& rule = this->draw_rules[index];
+        CompiledDrawRule compiled_rule;
+        compiled_rule.draw_line_size = rule.draw_line_size;
+        compiled_rule.turn_angle = rule.turn_angle;
+        compiled_rule.end_this_branch = rule.end_this_branch;
+        compiled_rule.push_fifo = rule.push_fifo;
+        compiled_rule.pop_fifo = rule.pop_fifo;
+        this->compiled_rules.push_back(compiled_rule);
+
+        // Like a linear search, the first rule for a symbol wins
+        const auto rule_index = static_cast<std::uint32_t>(index);
+        unsigned char byte;
+        if (SymbolByte<SymbolType>::Get(rule.symbolType, byte)) {
+            if (this->byte_table[byte] == no_rule) {
+                this->byte_table[byte] = rule_index;
+            }
+        } else {
+            this->symbol_table.emplace(rule.symbolType, rule_index);
+        }
+    }
+
+    // Looking for the smallest direction count that fits all turns
+    constexpr double two_pi = 6.283185307179586;
+    for (std::int32_t direction_count = 1; direction_count <= max_directions && !this->quantized; direction_count++) {
+        this->quantized = std::all_of(this->compiled_rules.begin(), this->compiled_rules.end(),
+            [direction_count](const CompiledDrawRule& rule) {
+                const double steps = rule.turn_angle * direction_count / two_pi;
+                return std::abs(steps - std::round(steps)) < 1e-4;
+            }
+        );
+        if (!this->quantized) {
+            continue;
+        }
+
+        for (auto& rule: this->compiled_rules) {
+            const auto steps = static_cast<std::int32_t>(std::lround(rule.turn_angle * direction_count / two_pi));
+            rule.turn_steps = ((steps % direction_count) + direction_count) % direction_count;
+        }
+        for (std::int32_t heading = 0; heading < direction_count; heading++) {
+            const double angle = two_pi * heading / direction_count;
+            this->directions.push_back({static_cast<float>(std::sin(angle)), static_cast<float>(std::cos(angle)),
+                                        static_cast<float>(angle)});
+        }
+    }
+}
+
+template<typename SymbolType>
+std::uint32_t Turtle<SymbolType>::RuleIndexFromSymbol(const SymbolType& symbol) const {
+    unsigned char byte;
+    if (SymbolByte<SymbolType>::Get(symbol, byte)) {
+        return this->byte_table[byte];
+    }
+    const auto symbol_iter = this->symbol_table.find(symbol);
+    if (symbol_iter == this->symbol_table.end()) {
+        return no_rule;
+    }
+    return symbol_iter->second;
+}
+
+template<typename SymbolType>
+const DrawRuleStruct<SymbolType>* Turtle<SymbolType>::DrawruleFromSymbol(const SymbolType& symbol) const {
+    const std::uint32_t rule_index = this->RuleIndexFromSymbol(symbol);
+    if (rule_index == no_rule) {
+        return nullptr;
+    }
+    return &this->draw_rules[rule_index];
+}
+
+template<typename SymbolType>
+template<typename SegmentSink, typename StateVisitor>
+void Turtle<SymbolType>::Interpret(const std::vector<SymbolType>& input, const float size_multiplier,
+                                   SegmentSink&& segment_sink, StateVisitor&& state_visitor) const {
+    // Working variables
+    TurtleStack lifo(this->MaxBranchDepth(input));
+    TurtleState current{this->origin, 0.0f};
+
+    for (std::size_t index = 0; index < input.size(); index++) {
+        const SymbolType& symbol = input[index];
+        state_visitor(index, symbol, current);
+
+        const std::uint32_t rule_index = this->RuleIndexFromSymbol(symbol);
+        if (rule_index == no_rule) {
+            continue;
+        }
+        this->Apply(this->compiled_rules[rule_index], size_multiplier, current, lifo, segment_sink);
+    }
+}
+
+template<typename SymbolType>
+std::size_t Turtle<SymbolType>::MaxBranchDepth(const std::vector<SymbolType>& input) const {
+    std::size_t depth = 0;
+    std::size_t max_depth = 0;
+    for (const auto& symbol: input) {
+        const std::uint32_t rule_index = this->RuleIndexFromSymbol(symbol);
+        if (rule_index == no_rule) {
+            continue;
+        }
+        const CompiledDrawRule& draw_rule = this->compiled_rules[rule_index];
+        // Same order as `Apply`, push first
+        if (draw_rule.push_fifo) {
+            depth++;
+            max_depth = std::max(max_depth, depth);
+        }
+        if (draw_rule.pop_fifo) {
+            if (depth == 0) {
+                throw std::invalid_argument("Input closes a branch that was never opened");
+            }
+            depth--;
+        }
+    }
+    return max_depth;
+}
+
+template<typename SymbolType>
+TurtleTransform Turtle<SymbolType>::TransformFromRule(const CompiledDrawRule& draw_rule, const float size_multiplier) const {
+    if (draw_rule.end_this_branch) {
+        return {};
+    }
+    const float line_size = draw_rule.draw_line_size * size_multiplier;
+    return {draw_rule.turn_angle,
+            {line_size * sinf(draw_rule.turn_angle), -line_size * cosf(draw_rule.turn_angle)},
+            draw_rule.turn_steps};
+}
+
+template<typename SymbolType>
+void Turtle<SymbolType>::NormalizeHeading(TurtleState& state) const {
+    if (!this->quantized) {
+        return;
+    }
+    const auto direction_count = static_cast<std::int32_t>(this->directions.size());
+    state.heading = ((state.heading % direction_count) + direction_count) % direction_count;
+    state.angle = this->directions[state.heading].angle;
+}
+
+template<typename SymbolType>
+template<typename Stack, typename SegmentSink>
+void Turtle<SymbolType>::Apply(const CompiledDrawRule& draw_rule, const float size_multiplier, TurtleState& current,
+                               Stack& lifo, SegmentSink&& segment_sink) const {
+    const float line_size = draw_rule.draw_line_size * size_multiplier;
+
+    // Fifo
+    if (draw_rule.push_fifo) {
+        lifo.push(current);
+    }
+    if (draw_rule.pop_fifo) {
+        current = lifo.top();
+        lifo.pop();
+    }
+
+    // Constructing next state
+    TurtleState next = current;
+    float sin_angle;
+    float cos_angle;
+    if (this->quantized) {
+        next.heading = current.heading + draw_rule.turn_steps;
+        if (next.heading >= static_cast<std::int32_t>(this->directions.size())) {
+            next.heading -= static_cast<std::int32_t>(this->directions.size());
+        }
+        const Direction& direction = this->directions[next.heading];
+        next.angle = direction.angle;
+        sin_angle = direction.sin;
+        cos_angle = direction.cos;
+    } else {
+        next.angle = current.angle + draw_rule.turn_angle;
+        sin_angle = line_size != 0.0f ? sinf(next.angle) : 0.0f;
+        cos_angle = line_size != 0.0f ? cosf(next.angle) : 0.0f;
+    }
+    next.position = {current.position.x + line_size * sin_angle, current.position.y - line_size * cos_angle};
+
+    // A zero length line does not draw anything, don't bother the sink with it
+    if (line_size != 0.0f) {
+        segment_sink(current.position, next.position);
+    }
+
+    // Saving state
+    if (not draw_rule.end_this_branch) {
+        current = next;
+    }
+}
+
+template<typename SymbolType>
+template<typename SegmentSink>
+void Turtle<SymbolType>::Interpret(const std::vector<SymbolType>& input, const float size_multiplier, SegmentSink&& segment_sink) const {
+    this->Interpret(input, size_multiplier, segment_sink,
+                    [](std::size_t, const SymbolType&, const TurtleState&) { });
+}
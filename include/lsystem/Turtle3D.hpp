@@ -0,0 +1,145 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "Turtle.hpp"
+
+
+struct TurtleVector3 {
+    float x{0};
+    float y{0};
+    float z{0};
+};
+
+// Unit quaternion, used as the orientation of the 3D turtle.
+// Four floats are cheaper to copy onto the branch stack than a full rotation frame,
+// and renormalising one is trivial, so rounding errors don't skew the frame.
+struct TurtleQuaternion {
+    float w{1};
+    float x{0};
+    float y{0};
+    float z{0};
+
+    static TurtleQuaternion FromAxisAngle(const TurtleVector3& axis, float angle);
+    TurtleQuaternion operator*(const TurtleQuaternion& other) const;
+    TurtleVector3 Rotate(const TurtleVector3& vector) const;
+    TurtleQuaternion Normalized() const;
+};
+
+// One branch segment, drawn as a unit cylinder (radius 1, height 1 along +y)
+// scaled, rotated and moved into place by the GPU.
+// 9 floats per segment, so even a million branches stay around 36MB.
+struct CylinderInstance {
+    TurtleVector3 position{};
+    TurtleQuaternion rotation{};
+    float length{0};
+    float radius{0};
+
+    // Column major 4x4 matrix: translate(position) * rotate(rotation) * scale(radius, length, radius)
+    void ToMatrix(float matrix[16]) const;
+};
+
+struct TurtleState3D {
+    TurtleVector3 position{};
+    TurtleQuaternion orientation{};
+    float radius{1};
+};
+
+// Writes instances as a small header ("LSC3", version, count) followed by the raw array,
+// the file can be uploaded to an instance buffer as is.
+// Throws std::runtime_error if the file can't be written.
+void WriteCylinderInstances(const std::string& path, const std::vector<CylinderInstance>& instances);
+std::vector<CylinderInstance> ReadCylinderInstances(const std::string& path);
+
+
+// 3D version of `Turtle`.
+// The turtle has a heading (H), left (L) and up (U) axis, starting as H = +y, L = -x, U = +z.
+// Yaw turns around U, pitch around L and roll around H. A positive yaw turns to the right when
+// looking down the z axis, so a 2D grammar draws the same picture in the xy plane as `Turtle` does
+// (with y pointing up instead of down).
+template <typename SymbolType>
+class Turtle3D {
+public:
+    Turtle3D() = default;
+    Turtle3D(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules, const TurtleVector3& origin, float radius);
+
+    // Clears `instances` and fills it with one cylinder per drawn segment
+    void Interpret(const std::vector<SymbolType>& input, float size_multiplier,
+                   std::vector<CylinderInstance>& instances) const;
+
+private:
+    Turtle<SymbolType> turtle;
+    TurtleVector3 origin{};
+    float radius{1};
+};
+
+
+template<typename SymbolType>
+Turtle3D<SymbolType>::Turtle3D(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules,
+                               const TurtleVector3& origin, const float radius):
+    turtle(draw_rules, {origin.x, origin.y}), origin(origin), radius(radius) { }
+
+template<typename SymbolType>
+void Turtle3D<SymbolType>::Interpret(const std::vector<SymbolType>& input, const float size_multiplier,
+                                     std::vector<CylinderInstance>& instances) const {
+    const TurtleVector3 heading_axis{0.0f, 1.0f, 0.0f};
+    const TurtleVector3 left_axis{-1.0f, 0.0f, 0.0f};
+    const TurtleVector3 up_axis{0.0f, 0.0f, 1.0f};
+
+    instances.clear();
+    std::vector<TurtleState3D> lifo;
+    lifo.reserve(this->turtle.MaxBranchDepth(input));
+    TurtleState3D current{this->origin, {}, this->radius * size_multiplier};
+
+    for (const auto& symbol: input) {
+        const auto* draw_rule = this->turtle.DrawruleFromSymbol(symbol);
+        if (draw_rule == nullptr) {
+            continue;
+        }
+        const float line_size = draw_rule->draw_line_size * size_multiplier;
+
+        // Fifo
+        if (draw_rule->push_fifo) {
+            lifo.push_back(current);
+        }
+        if (draw_rule->pop_fifo) {
+            current = lifo.back();
+            lifo.pop_back();
+        }
+
+        // Rotations are intrinsic, around the turtle's own axes
+        TurtleQuaternion orientation = current.orientation;
+        const float yaw = draw_rule->turn_angle + draw_rule->yaw_angle;
+        if (yaw != 0.0f) {
+            orientation = orientation * TurtleQuaternion::FromAxisAngle(up_axis, -yaw);
+        }
+        if (draw_rule->pitch_angle != 0.0f) {
+            orientation = orientation * TurtleQuaternion::FromAxisAngle(left_axis, draw_rule->pitch_angle);
+        }
+        if (draw_rule->roll_angle != 0.0f) {
+            orientation = orientation * TurtleQuaternion::FromAxisAngle(heading_axis, draw_rule->roll_angle);
+        }
+        orientation = orientation.Normalized();
+        const float branch_radius = current.radius * draw_rule->radius_scale;
+
+        // Constructing next position
+        const TurtleVector3 heading = orientation.Rotate(heading_axis);
+        const TurtleVector3 next_pos = {current.position.x + line_size * heading.x,
+                                        current.position.y + line_size * heading.y,
+                                        current.position.z + line_size * heading.z};
+
+        if (line_size != 0.0f) {
+            instances.push_back({current.position, orientation, line_size, branch_radius});
+        }
+
+        // Saving state
+        if (not draw_rule->end_this_branch) {
+            current.orientation = orientation;
+            current.position = next_pos;
+            current.radius = branch_radius;
+        }
+    }
+}
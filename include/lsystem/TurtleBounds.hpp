@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "Turtle.hpp"
+
+
+// Axis aligned bounding box in turtle space, starts out empty
+struct TurtleBounds {
+    TurtleVector min{INFINITY, INFINITY};
+    TurtleVector max{-INFINITY, -INFINITY};
+
+    bool Empty() const { return min.x > max.x || min.y > max.y; }
+    float Width() const { return Empty() ? 0.0f : max.x - min.x; }
+    float Height() const { return Empty() ? 0.0f : max.y - min.y; }
+
+    void Add(const TurtleVector& point) {
+        min = {std::min(min.x, point.x), std::min(min.y, point.y)};
+        max = {std::max(max.x, point.x), std::max(max.y, point.y)};
+    }
+
+    void Add(const TurtleBounds& other) {
+        if (!other.Empty()) {
+            Add(other.min);
+            Add(other.max);
+        }
+    }
+
+    bool Intersects(const TurtleBounds& other) const {
+        return !Empty() && !other.Empty() &&
+               min.x <= other.max.x && other.min.x <= max.x &&
+               min.y <= other.max.y && other.min.y <= max.y;
+    }
+
+    bool Contains(const TurtleVector& point) const {
+        return point.x >= min.x && point.x <= max.x && point.y >= min.y && point.y <= max.y;
+    }
+
+    // Box around this box after it was moved by `transform` (the corners are transformed,
+    // so the result is conservative when rotated)
+    TurtleBounds Transformed(const TurtleTransform& transform) const {
+        TurtleBounds result;
+        if (Empty()) {
+            return result;
+        }
+        for (const TurtleVector& corner: {min, TurtleVector{min.x, max.y}, max, TurtleVector{max.x, min.y}}) {
+            result.Add(transform.Then({0.0f, corner, 0}).offset);
+        }
+        return result;
+    }
+};
+
+
+// Convex hull of the points (counter clockwise, no duplicates), Andrew's monotone chain.
+// Hulls can be moved by a rigid transform without losing precision, unlike boxes.
+inline std::vector<TurtleVector> ConvexHull(std::vector<TurtleVector> points) {
+    std::sort(points.begin(), points.end(), [](const TurtleVector& a, const TurtleVector& b) {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+    points.erase(std::unique(points.begin(), points.end(), [](const TurtleVector& a, const TurtleVector& b) {
+        return a.x == b.x && a.y == b.y;
+    }), points.end());
+    if (points.size() < 3) {
+        return points;
+    }
+
+    const auto cross = [](const TurtleVector& o, const TurtleVector& a, const TurtleVector& b) {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+    };
+    std::vector<TurtleVector> hull(2 * points.size());
+    std::size_t size = 0;
+    for (const auto& point: points) {
+        while (size >= 2 && cross(hull[size - 2], hull[size - 1], point) <= 0.0f) {
+            size--;
+        }
+        hull[size++] = point;
+    }
+    const std::size_t lower_size = size + 1;
+    for (auto point = points.rbegin() + 1; point != points.rend(); point++) {
+        while (size >= lower_size && cross(hull[size - 2], hull[size - 1], *point) <= 0.0f) {
+            size--;
+        }
+        hull[size++] = *point;
+    }
+    hull.resize(size - 1);
+    return hull;
+}
+
+
+// Maps turtle space onto the screen: screen = turtle * scale + offset
+struct TurtleView {
+    float scale{1.0f};
+    TurtleVector offset{};
+
+    TurtleVector ToScreen(const TurtleVector& point) const {
+        return {point.x * scale + offset.x, point.y * scale + offset.y};
+    }
+    TurtleVector ToTurtle(const TurtleVector& point) const {
+        return {(point.x - offset.x) / scale, (point.y - offset.y) / scale};
+    }
+    // Zooms by `factor`, the turtle point under `screen_point` stays where it is
+    TurtleView ZoomedAt(const TurtleVector& screen_point, const float factor) const {
+        return {scale * factor, {screen_point.x - (screen_point.x - offset.x) * factor,
+                                 screen_point.y - (screen_point.y - offset.y) * factor}};
+    }
+    TurtleView Panned(const TurtleVector& screen_delta) const {
+        return {scale, {offset.x + screen_delta.x, offset.y + screen_delta.y}};
+    }
+    bool operator==(const TurtleView& other) const {
+        return scale == other.scale && offset.x == other.offset.x && offset.y == other.offset.y;
+    }
+
+    // Part of turtle space that is visible on a screen of the given size
+    TurtleBounds Visible(const float width, const float height) const {
+        TurtleBounds bounds;
+        bounds.Add(ToTurtle({0.0f, 0.0f}));
+        bounds.Add(ToTurtle({width, height}));
+        return bounds;
+    }
+};
+
+// View that centers the bounds on a screen of the given size, keeping `margin` pixels free on every side
+inline TurtleView FitView(const TurtleBounds& bounds, const float width, const float height, const float margin) {
+    if (bounds.Empty()) {
+        return {};
+    }
+    const float available_width = std::max(1.0f, width - 2.0f * margin);
+    const float available_height = std::max(1.0f, height - 2.0f * margin);
+    const float scale = std::min(available_width / std::max(bounds.Width(), 1e-6f),
+                                 available_height / std::max(bounds.Height(), 1e-6f));
+    const TurtleVector center{(bounds.min.x + bounds.max.x) / 2.0f, (bounds.min.y + bounds.max.y) / 2.0f};
+    return {scale, {width / 2.0f - center.x * scale, height / 2.0f - center.y * scale}};
+}
@@ -0,0 +1,114 @@
+#include "../include/lsystem/Density.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "../include/lsystem/Parallel.hpp"
+
+
+void DensityBuffer::AddLine(const TurtleVector& start, const TurtleVector& end) {
+    // Liang-Barsky clipping against [0, width] x [0, height]
+    const float delta_x = end.x - start.x;
+    const float delta_y = end.y - start.y;
+    float enter = 0.0f;
+    float leave = 1.0f;
+    const auto clip = [&enter, &leave](const float direction, const float distance) {
+        if (direction == 0.0f) {
+            return distance >= 0.0f;
+        }
+        const float t = distance / direction;
+        if (direction < 0.0f) {
+            enter = std::max(enter, t);
+        } else {
+            leave = std::min(leave, t);
+        }
+        return enter <= leave;
+    };
+    if (!(clip(-delta_x, start.x) && clip(delta_x, static_cast<float>(this->width) - start.x) &&
+          clip(-delta_y, start.y) && clip(delta_y, static_cast<float>(this->height) - start.y))) {
+        return;
+    }
+
+    const float clipped_x = delta_x * (leave - enter);
+    const float clipped_y = delta_y * (leave - enter);
+    const float length = std::sqrt(clipped_x * clipped_x + clipped_y * clipped_y);
+    if (length == 0.0f) {
+        return;
+    }
+
+    // One sample per pixel along the longest axis, at the middle of every step, in 32.32 fixed point
+    const auto steps = static_cast<std::int64_t>(std::ceil(std::max(std::fabs(clipped_x), std::fabs(clipped_y))));
+    const float weight = length / static_cast<float>(steps);
+    constexpr double one = 4294967296.0;
+    const double step_x = static_cast<double>(clipped_x) / static_cast<double>(steps);
+    const double step_y = static_cast<double>(clipped_y) / static_cast<double>(steps);
+    auto x = static_cast<std::int64_t>((start.x + delta_x * enter + step_x / 2.0) * one);
+    auto y = static_cast<std::int64_t>((start.y + delta_y * enter + step_y / 2.0) * one);
+    const auto increment_x = static_cast<std::int64_t>(step_x * one);
+    const auto increment_y = static_cast<std::int64_t>(step_y * one);
+    const auto width = static_cast<std::int64_t>(this->width);
+    const auto height = static_cast<std::int64_t>(this->height);
+
+    for (std::int64_t step = 0; step < steps; step++, x += increment_x, y += increment_y) {
+        const std::int64_t column = std::clamp<std::int64_t>(x >> 32, 0, width - 1);
+        const std::int64_t row = std::clamp<std::int64_t>(y >> 32, 0, height - 1);
+        this->density[static_cast<std::size_t>(row * width + column)] += weight;
+    }
+}
+
+void AccumulateDensity(const SegmentBuffer& lines, DensityBuffer& buffer, unsigned thread_count) {
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+    // Small inputs aren't worth a buffer per thread
+    const std::size_t chunk_count = std::max<std::size_t>(1, std::min<std::size_t>(thread_count, lines.Size() / (1 << 14)));
+    const std::size_t chunk_size = (lines.Size() + chunk_count - 1) / chunk_count;
+    AccumulateDensityParts(chunk_count, buffer, thread_count, [&](const std::size_t chunk, DensityBuffer& target) {
+        const std::size_t end = std::min(lines.Size(), (chunk + 1) * chunk_size);
+        for (std::size_t i = chunk * chunk_size; i < end; i++) {
+            target.AddLine(lines.Start(i), lines.End(i));
+        }
+    });
+}
+
+void SumDensity(const std::vector<DensityBuffer>& partial, DensityBuffer& buffer, const unsigned thread_count) {
+    if (partial.empty()) {
+        return;
+    }
+    const std::size_t block_rows = 16;
+    ParallelFor((buffer.height + block_rows - 1) / block_rows, thread_count, [&](const std::size_t block) {
+        const std::size_t begin = block * block_rows * buffer.width;
+        const std::size_t end = std::min(buffer.height, (block + 1) * block_rows) * buffer.width;
+        for (const auto& other: partial) {
+            for (std::size_t i = begin; i < end; i++) {
+                buffer.density[i] += other.density[i];
+            }
+        }
+    });
+}
+
+void ToneMapDensity(const DensityBuffer& buffer, const RasterColor background, const RasterColor ink,
+                    const float exposure, Framebuffer& framebuffer) {
+    framebuffer = Framebuffer(buffer.width, buffer.height, background);
+    float max_density = 0.0f;
+    for (const auto value: buffer.density) {
+        max_density = std::max(max_density, value);
+    }
+    if (max_density <= 0.0f) {
+        return;
+    }
+
+    const float scale = 1.0f / std::log1p(exposure * max_density);
+    const auto mix = [](const std::uint8_t from, const std::uint8_t to, const float t) {
+        return static_cast<std::uint8_t>(std::lround(static_cast<float>(from) + (static_cast<float>(to) - static_cast<float>(from)) * t));
+    };
+    for (std::size_t i = 0; i < buffer.density.size(); i++) {
+        const float t = std::log1p(exposure * buffer.density[i]) * scale;
+        std::uint8_t* pixel = framebuffer.rgba.data() + 4 * i;
+        pixel[0] = mix(background.r, ink.r, t);
+        pixel[1] = mix(background.g, ink.g, t);
+        pixel[2] = mix(background.b, ink.b, t);
+        pixel[3] = mix(background.a, ink.a, t);
+    }
+}
@@ -0,0 +1,78 @@
+#include "../include/lsystem/GridEnvironment.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+GridEnvironment::GridEnvironment(const TurtleVector& grid_origin, const float cell_size,
+                                 const std::size_t columns, const std::size_t rows, const float probe_distance):
+    grid_origin(grid_origin), cell_size(cell_size), columns(columns), rows(rows), probe_distance(probe_distance),
+    obstacles(columns * rows, 0), segments(columns * rows, 0) {
+    if (cell_size <= 0.0f) {
+        throw std::invalid_argument("Cell size of environment must be positive");
+    }
+}
+
+void GridEnvironment::ClearSegments() {
+    std::fill(this->segments.begin(), this->segments.end(), 0);
+}
+
+bool GridEnvironment::CellFromPosition(const TurtleVector& position, std::size_t& cell) const {
+    const float column = std::floor((position.x - this->grid_origin.x) / this->cell_size);
+    const float row = std::floor((position.y - this->grid_origin.y) / this->cell_size);
+    if (column < 0.0f || row < 0.0f ||
+        column >= static_cast<float>(this->columns) || row >= static_cast<float>(this->rows)) {
+        return false;
+    }
+    cell = static_cast<std::size_t>(row) * this->columns + static_cast<std::size_t>(column);
+    return true;
+}
+
+void GridEnvironment::AddObstacle(const TurtleVector& min, const TurtleVector& max) {
+    for (std::size_t row = 0; row < this->rows; row++) {
+        for (std::size_t column = 0; column < this->columns; column++) {
+            // Cell centre inside the box
+            const float x = this->grid_origin.x + (static_cast<float>(column) + 0.5f) * this->cell_size;
+            const float y = this->grid_origin.y + (static_cast<float>(row) + 0.5f) * this->cell_size;
+            if (x >= min.x && x <= max.x && y >= min.y && y <= max.y) {
+                this->obstacles[row * this->columns + column] += 1;
+            }
+        }
+    }
+}
+
+void GridEnvironment::AddSegment(const TurtleVector& start, const TurtleVector& end) {
+    // Walk the segment in half cell steps, every cell is counted once per segment
+    const float dx = end.x - start.x;
+    const float dy = end.y - start.y;
+    const float length = std::sqrt(dx * dx + dy * dy);
+    const auto steps = static_cast<std::size_t>(std::ceil(2.0f * length / this->cell_size));
+
+    std::size_t previous_cell = this->columns * this->rows;  // Not a valid cell
+    for (std::size_t step = 0; step <= steps; step++) {
+        const float t = steps == 0 ? 0.0f : static_cast<float>(step) / static_cast<float>(steps);
+        std::size_t cell;
+        if (this->CellFromPosition({start.x + t * dx, start.y + t * dy}, cell) && cell != previous_cell) {
+            this->segments[cell] += 1;
+            previous_cell = cell;
+        }
+    }
+}
+
+float GridEnvironment::Query(const TurtleState& state) const {
+    const TurtleVector probe = {state.position.x + this->probe_distance * std::sin(state.angle),
+                                state.position.y - this->probe_distance * std::cos(state.angle)};
+    std::size_t cell;
+    if (!this->CellFromPosition(probe, cell)) {
+        return INFINITY;
+    }
+    return static_cast<float>(this->obstacles[cell] + this->segments[cell]);
+}
+
+void GridEnvironment::QueryBatch(const std::vector<TurtleState>& states, std::vector<float>& values) const {
+    values.resize(states.size());
+    for (std::size_t i = 0; i < states.size(); i++) {
+        values[i] = this->Query(states[i]);
+    }
+}
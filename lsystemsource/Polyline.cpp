@@ -0,0 +1,133 @@
+#include "../include/lsystem/Polyline.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+    constexpr float pi_f = 3.14159265f;
+}
+
+
+PolylineBuilder::PolylineBuilder(PolylineBuffer& polylines, const float tolerance):
+    polylines(polylines), tolerance(tolerance) { }
+
+void PolylineBuilder::operator()(const TurtleVector& start, const TurtleVector& end) {
+    const float join_x = start.x - this->pen.x;
+    const float join_y = start.y - this->pen.y;
+    if (!this->open || join_x * join_x + join_y * join_y > this->tolerance * this->tolerance) {
+        this->Finish();
+        this->polylines.x.push_back(start.x);
+        this->polylines.y.push_back(start.y);
+        this->open = true;
+    }
+    this->pen = end;
+
+    // Too close to the last point to be seen, `pen` keeps track of where the polyline really is
+    const std::size_t last = this->polylines.PointCount() - 1;
+    const float step_x = end.x - this->polylines.x[last];
+    const float step_y = end.y - this->polylines.y[last];
+    if (step_x * step_x + step_y * step_y < this->tolerance * this->tolerance) {
+        // Still has to stay close to the line if the last point moves on
+        this->Constrain(end);
+        return;
+    }
+    this->AddPoint(end);
+}
+
+void PolylineBuilder::Constrain(const TurtleVector& point) {
+    const std::size_t first = this->polylines.begin.back();
+    const std::size_t count = this->polylines.PointCount() - first;
+    if (count < 2) {
+        return;
+    }
+    const TurtleVector anchor = this->polylines.Point(first + count - 2);
+    const float distance = std::hypot(point.x - anchor.x, point.y - anchor.y);
+    if (distance <= this->tolerance) {
+        return;
+    }
+    const float angle = std::remainder(std::atan2(point.y - anchor.y, point.x - anchor.x) - this->wedge_center,
+                                       2.0f * pi_f);
+    const float half_width = std::asin(this->tolerance / distance);
+    this->wedge_low = std::max(this->wedge_low, angle - half_width);
+    this->wedge_high = std::min(this->wedge_high, angle + half_width);
+    this->reach = std::max(this->reach, distance);
+}
+
+void PolylineBuilder::AddPoint(const TurtleVector& point) {
+    const std::size_t first = this->polylines.begin.back();
+    const std::size_t count = this->polylines.PointCount() - first;
+    if (count >= 2) {
+        // The new point can replace the last one if the line from the anchor to it passes within the tolerance
+        // of every point dropped so far: its direction is in the wedge. Only further out than all of them,
+        // a branch that goes back on itself keeps its tip.
+        const TurtleVector anchor = this->polylines.Point(first + count - 2);
+        const float distance = std::hypot(point.x - anchor.x, point.y - anchor.y);
+        const float angle = std::remainder(std::atan2(point.y - anchor.y, point.x - anchor.x) - this->wedge_center,
+                                           2.0f * pi_f);
+        if (distance >= this->reach && angle >= this->wedge_low && angle <= this->wedge_high) {
+            this->Constrain(point);
+            this->polylines.x.back() = point.x;
+            this->polylines.y.back() = point.y;
+            return;
+        }
+    }
+    this->polylines.x.push_back(point.x);
+    this->polylines.y.push_back(point.y);
+
+    // The last point becomes the anchor, the new point limits the directions from it
+    if (count >= 1) {
+        const TurtleVector anchor = this->polylines.Point(first + count - 1);
+        this->wedge_center = std::atan2(point.y - anchor.y, point.x - anchor.x);
+        this->wedge_low = -pi_f;
+        this->wedge_high = pi_f;
+        this->reach = 0.0f;
+        this->Constrain(point);
+    }
+}
+
+void PolylineBuilder::Finish() {
+    if (!this->open) {
+        return;
+    }
+    this->open = false;
+
+    const std::size_t first = this->polylines.begin.back();
+    const TurtleVector last = this->polylines.Point(this->polylines.PointCount() - 1);
+    if (last.x != this->pen.x || last.y != this->pen.y) {
+        if (this->polylines.PointCount() - first == 1) {
+            // The whole polyline is below the tolerance, nothing to see
+            this->polylines.x.resize(first);
+            this->polylines.y.resize(first);
+            return;
+        }
+        this->AddPoint(this->pen);
+    }
+    if (this->polylines.PointCount() - first < 2) {
+        this->polylines.x.resize(first);
+        this->polylines.y.resize(first);
+        return;
+    }
+    this->polylines.begin.push_back(this->polylines.PointCount());
+}
+
+PolylineBuffer SimplifySegments(const SegmentBuffer& segments, const float tolerance) {
+    PolylineBuffer polylines;
+    PolylineBuilder builder(polylines, tolerance);
+    for (std::size_t i = 0; i < segments.Size(); i++) {
+        builder(segments.Start(i), segments.End(i));
+    }
+    builder.Finish();
+    return polylines;
+}
+
+SegmentBuffer PolylinePieces(const PolylineBuffer& polylines) {
+    SegmentBuffer pieces;
+    pieces.Reserve(polylines.SegmentCount());
+    for (std::size_t line = 0; line < polylines.Size(); line++) {
+        for (std::size_t i = polylines.begin[line] + 1; i < polylines.begin[line + 1]; i++) {
+            pieces.Add(polylines.Point(i - 1), polylines.Point(i));
+        }
+    }
+    return pieces;
+}
@@ -0,0 +1,425 @@
+#include "../include/lsystem/Rasterizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#include "../include/lsystem/Parallel.hpp"
+
+
+Framebuffer::Framebuffer(const std::size_t width, const std::size_t height, const RasterColor background):
+    width(width), height(height), rgba(4 * width * height) {
+    for (std::size_t i = 0; i < width * height; i++) {
+        rgba[4 * i] = background.r;
+        rgba[4 * i + 1] = background.g;
+        rgba[4 * i + 2] = background.b;
+        rgba[4 * i + 3] = background.a;
+    }
+}
+
+namespace {
+    struct PixelRange {
+        std::size_t min_x, max_x, min_y, max_y;  // Inclusive
+    };
+
+    // Pixels a line can touch, false if it misses the framebuffer
+    bool LinePixels(const SegmentBuffer& lines, const std::size_t index, const float half_width,
+                    const std::size_t width, const std::size_t height, PixelRange& range) {
+        const float reach = half_width + 1.0f;
+        const float min_x = std::min(lines.start_x[index], lines.end_x[index]) - reach;
+        const float max_x = std::max(lines.start_x[index], lines.end_x[index]) + reach;
+        const float min_y = std::min(lines.start_y[index], lines.end_y[index]) - reach;
+        const float max_y = std::max(lines.start_y[index], lines.end_y[index]) + reach;
+        if (!(max_x >= 0.0f && max_y >= 0.0f &&
+              min_x < static_cast<float>(width) && min_y < static_cast<float>(height))) {
+            return false;  // Also catches NaN
+        }
+        range.min_x = static_cast<std::size_t>(std::max(0.0f, min_x));
+        range.min_y = static_cast<std::size_t>(std::max(0.0f, min_y));
+        range.max_x = std::min(width - 1, static_cast<std::size_t>(max_x));
+        range.max_y = std::min(height - 1, static_cast<std::size_t>(max_y));
+        return true;
+    }
+
+    float HalfWidth(const std::vector<float>& thickness, const std::size_t index) {
+        return std::max(0.5f, thickness[index] / 2.0f);
+    }
+
+    // Blends one line into the pixels of `clip`, coverage from the distance between the pixel center and the line.
+    // The framebuffer covers the image from (origin_x, origin_y), for tiles that have their own buffer.
+    void DrawLine(const SegmentBuffer& lines, const std::size_t index, const float thickness, const RasterColor color,
+                  const PixelRange& clip, Framebuffer& framebuffer,
+                  const std::size_t origin_x = 0, const std::size_t origin_y = 0) {
+        const float start_x = lines.start_x[index];
+        const float start_y = lines.start_y[index];
+        const float length_x = lines.end_x[index] - start_x;
+        const float length_y = lines.end_y[index] - start_y;
+        const float length = length_x * length_x + length_y * length_y;
+        const float half_width = std::max(0.5f, thickness / 2.0f);
+        // Lines thinner than a pixel are drawn a pixel wide but fainter
+        const float opacity = std::min(1.0f, thickness) * static_cast<float>(color.a) / 255.0f;
+        const std::array<float, 3> source{static_cast<float>(color.r), static_cast<float>(color.g),
+                                          static_cast<float>(color.b)};
+
+        for (std::size_t y = clip.min_y; y <= clip.max_y; y++) {
+            const float pixel_y = static_cast<float>(y) + 0.5f;
+            for (std::size_t x = clip.min_x; x <= clip.max_x; x++) {
+                const float pixel_x = static_cast<float>(x) + 0.5f;
+                const float t = length == 0.0f ? 0.0f : std::clamp(
+                        ((pixel_x - start_x) * length_x + (pixel_y - start_y) * length_y) / length, 0.0f, 1.0f);
+                const float distance = std::hypot(start_x + t * length_x - pixel_x, start_y + t * length_y - pixel_y);
+                const float coverage = std::clamp(half_width + 0.5f - distance, 0.0f, 1.0f) * opacity;
+                if (coverage <= 0.0f) {
+                    continue;
+                }
+                std::uint8_t* pixel = framebuffer.Pixel(x - origin_x, y - origin_y);
+                for (std::size_t channel = 0; channel < 3; channel++) {
+                    const float value = static_cast<float>(pixel[channel]);
+                    pixel[channel] = static_cast<std::uint8_t>(std::lround(value + (source[channel] - value) * coverage));
+                }
+                const float alpha = static_cast<float>(pixel[3]);
+                pixel[3] = static_cast<std::uint8_t>(std::lround(alpha + (255.0f - alpha) * coverage));
+            }
+        }
+    }
+
+    // Line indices per square tile of an image, in one flat array:
+    // tile t lists lines[begin[t], begin[t + 1]), in submission order
+    struct TileBins {
+        std::size_t tile_size{0};
+        std::size_t columns{0};
+        std::size_t rows{0};
+        std::vector<std::size_t> begin;
+        std::vector<std::uint32_t> lines;
+
+        std::size_t Size() const { return columns * rows; }
+    };
+
+    // Binning, a counting pass and a filling pass
+    TileBins BinLines(const SegmentBuffer& lines, const std::vector<float>& thickness,
+                      const std::size_t width, const std::size_t height, const std::size_t tile_size) {
+        if (thickness.size() != lines.Size()) {
+            throw std::invalid_argument("Every line needs a thickness");
+        }
+        TileBins bins;
+        bins.tile_size = tile_size;
+        bins.columns = (width + tile_size - 1) / tile_size;
+        bins.rows = (height + tile_size - 1) / tile_size;
+        bins.begin.assign(bins.Size() + 1, 0);
+
+        const auto for_each_tile = [&](const std::size_t index, auto&& tile_visitor) {
+            PixelRange range{};
+            if (!LinePixels(lines, index, HalfWidth(thickness, index), width, height, range)) {
+                return;
+            }
+            for (std::size_t row = range.min_y / tile_size; row <= range.max_y / tile_size; row++) {
+                for (std::size_t column = range.min_x / tile_size; column <= range.max_x / tile_size; column++) {
+                    tile_visitor(row * bins.columns + column);
+                }
+            }
+        };
+        for (std::size_t i = 0; i < lines.Size(); i++) {
+            for_each_tile(i, [&bins](const std::size_t tile) { bins.begin[tile + 1]++; });
+        }
+        for (std::size_t tile = 0; tile < bins.Size(); tile++) {
+            bins.begin[tile + 1] += bins.begin[tile];
+        }
+        bins.lines.resize(bins.begin[bins.Size()]);
+        std::vector<std::size_t> next(bins.begin.begin(), bins.begin.end() - 1);
+        for (std::size_t i = 0; i < lines.Size(); i++) {
+            for_each_tile(i, [&](const std::size_t tile) { bins.lines[next[tile]++] = static_cast<std::uint32_t>(i); });
+        }
+        return bins;
+    }
+
+    // Draws the lines of one tile into `framebuffer`, which starts at (origin_x, origin_y) of the image
+    void DrawTile(const SegmentBuffer& lines, const std::vector<float>& thickness, const RasterColor color,
+                  const TileBins& bins, const std::size_t tile, const std::size_t width, const std::size_t height,
+                  Framebuffer& framebuffer, const std::size_t origin_x, const std::size_t origin_y) {
+        const std::size_t tile_x = (tile % bins.columns) * bins.tile_size;
+        const std::size_t tile_y = (tile / bins.columns) * bins.tile_size;
+        for (std::size_t i = bins.begin[tile]; i < bins.begin[tile + 1]; i++) {
+            const std::uint32_t index = bins.lines[i];
+            PixelRange clip{};
+            LinePixels(lines, index, HalfWidth(thickness, index), width, height, clip);
+            clip.min_x = std::max(clip.min_x, tile_x);
+            clip.min_y = std::max(clip.min_y, tile_y);
+            clip.max_x = std::min(clip.max_x, tile_x + bins.tile_size - 1);
+            clip.max_y = std::min(clip.max_y, tile_y + bins.tile_size - 1);
+            DrawLine(lines, index, thickness[index], color, clip, framebuffer, origin_x, origin_y);
+        }
+    }
+}
+
+void RasterizeLines(const SegmentBuffer& lines, const std::vector<float>& thickness, const RasterColor color,
+                    Framebuffer& framebuffer, const unsigned thread_count, const std::size_t tile_size) {
+    const TileBins bins = BinLines(lines, thickness, framebuffer.width, framebuffer.height,
+                                   std::max<std::size_t>(tile_size, 8));
+    ParallelFor(bins.Size(), thread_count, [&](const std::size_t tile) {
+        DrawTile(lines, thickness, color, bins, tile, framebuffer.width, framebuffer.height, framebuffer, 0, 0);
+    });
+}
+
+void WritePPM(const std::string& path, const Framebuffer& framebuffer) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + path + " for writing");
+    }
+    file << "P6\n" << framebuffer.width << " " << framebuffer.height << "\n255\n";
+    std::vector<char> row(3 * framebuffer.width);
+    for (std::size_t y = 0; y < framebuffer.height; y++) {
+        for (std::size_t x = 0; x < framebuffer.width; x++) {
+            const std::uint8_t* pixel = framebuffer.Pixel(x, y);
+            std::copy(pixel, pixel + 3, row.begin() + static_cast<std::ptrdiff_t>(3 * x));
+        }
+        file.write(row.data(), static_cast<std::streamsize>(row.size()));
+    }
+    if (!file) {
+        throw std::runtime_error("Could not write " + path);
+    }
+}
+
+namespace {
+    std::uint32_t Crc32(const std::uint8_t* data, const std::size_t size, std::uint32_t crc = 0) {
+        static const auto table = [] {
+            std::array<std::uint32_t, 256> values{};
+            for (std::uint32_t n = 0; n < 256; n++) {
+                std::uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1u) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                values[n] = c;
+            }
+            return values;
+        }();
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; i++) {
+            crc = table[(crc ^ data[i]) & 0xFFu] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void PushBigEndian(std::vector<std::uint8_t>& bytes, const std::uint32_t value) {
+        bytes.push_back(static_cast<std::uint8_t>(value >> 24));
+        bytes.push_back(static_cast<std::uint8_t>(value >> 16));
+        bytes.push_back(static_cast<std::uint8_t>(value >> 8));
+        bytes.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    void WriteChunk(std::ofstream& file, const char type[4], const std::vector<std::uint8_t>& data) {
+        std::vector<std::uint8_t> chunk;
+        PushBigEndian(chunk, static_cast<std::uint32_t>(data.size()));
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        PushBigEndian(chunk, Crc32(chunk.data() + 4, chunk.size() - 4));
+        file.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+    }
+}
+
+void WritePNG(const std::string& path, const Framebuffer& framebuffer) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + path + " for writing");
+    }
+    const std::uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<std::uint8_t> header;
+    PushBigEndian(header, static_cast<std::uint32_t>(framebuffer.width));
+    PushBigEndian(header, static_cast<std::uint32_t>(framebuffer.height));
+    header.insert(header.end(), {8, 6, 0, 0, 0});  // 8 bit RGBA, no interlacing
+    WriteChunk(file, "IHDR", header);
+
+    // Every row starts with filter type 0, the zlib stream consists of stored (uncompressed) blocks
+    std::vector<std::uint8_t> raw;
+    raw.reserve(framebuffer.height * (4 * framebuffer.width + 1));
+    for (std::size_t y = 0; y < framebuffer.height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), framebuffer.Pixel(0, y), framebuffer.Pixel(0, y) + 4 * framebuffer.width);
+    }
+    std::vector<std::uint8_t> zlib{0x78, 0x01};
+    for (std::size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535) {
+        const auto block = static_cast<std::uint16_t>(std::min<std::size_t>(65535, raw.size() - offset));
+        const auto inverse = static_cast<std::uint16_t>(~block);
+        const bool last = offset + block >= raw.size();
+        zlib.insert(zlib.end(), {static_cast<std::uint8_t>(last ? 1 : 0),
+                                 static_cast<std::uint8_t>(block), static_cast<std::uint8_t>(block >> 8),
+                                 static_cast<std::uint8_t>(inverse), static_cast<std::uint8_t>(inverse >> 8)});
+        zlib.insert(zlib.end(), raw.begin() + static_cast<std::ptrdiff_t>(offset),
+                    raw.begin() + static_cast<std::ptrdiff_t>(offset + block));
+        if (last) {
+            break;
+        }
+    }
+    std::uint32_t adler_a = 1;
+    std::uint32_t adler_b = 0;
+    for (const auto byte: raw) {
+        adler_a = (adler_a + byte) % 65521u;
+        adler_b = (adler_b + adler_a) % 65521u;
+    }
+    PushBigEndian(zlib, (adler_b << 16) | adler_a);
+    WriteChunk(file, "IDAT", zlib);
+    WriteChunk(file, "IEND", {});
+
+    if (!file) {
+        throw std::runtime_error("Could not write " + path);
+    }
+}
+
+namespace {
+    // Little endian, as announced by the "II" of the TIFF header
+    void PushLittleEndian(std::vector<std::uint8_t>& bytes, const std::uint64_t value, const std::size_t size) {
+        for (std::size_t i = 0; i < size; i++) {
+            bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // Header and directory of a tiled TIFF, everything before the first tile.
+    // Classic TIFF has 4 byte offsets, BigTIFF 8 byte ones and larger directory entries.
+    class TiffLayout {
+    public:
+        TiffLayout(const std::size_t width, const std::size_t height, const std::size_t tile_size,
+                   const std::size_t tile_count):
+            tile_bytes(4 * tile_size * tile_size) {
+            // The directory has a fixed size, so the first tile offset is known before writing anything
+            for (const bool try_big: {false, true}) {
+                this->big = try_big;
+                this->Build(width, height, tile_size, tile_count);
+                if (this->big || this->data_start + tile_count * this->tile_bytes <= 0xFFFFFFFFull) {
+                    break;
+                }
+            }
+        }
+
+        std::uint64_t TileOffset(const std::size_t tile) const { return data_start + tile * tile_bytes; }
+        const std::vector<std::uint8_t>& getHead() const { return head; }
+
+    private:
+        enum Type : std::uint16_t { short_type = 3, long_type = 4, long8_type = 16 };
+
+        struct Entry {
+            std::uint16_t tag;
+            std::uint16_t type;
+            std::uint64_t count;
+            std::vector<std::uint8_t> value;
+        };
+
+        void Build(const std::size_t width, const std::size_t height, const std::size_t tile_size,
+                   const std::size_t tile_count) {
+            const std::size_t offset_size = this->big ? 8 : 4;
+            const std::uint16_t offset_type = this->big ? long8_type : long_type;
+            const auto values = [](const std::uint64_t value, const std::size_t size, const std::size_t count) {
+                std::vector<std::uint8_t> bytes;
+                for (std::size_t i = 0; i < count; i++) {
+                    PushLittleEndian(bytes, value, size);
+                }
+                return bytes;
+            };
+            std::vector<Entry> entries{
+                {256, long_type, 1, values(width, 4, 1)},
+                {257, long_type, 1, values(height, 4, 1)},
+                {258, short_type, 4, values(8, 2, 4)},              // Bits per sample
+                {259, short_type, 1, values(1, 2, 1)},              // No compression
+                {262, short_type, 1, values(2, 2, 1)},              // RGB
+                {277, short_type, 1, values(4, 2, 1)},              // Samples per pixel
+                {284, short_type, 1, values(1, 2, 1)},              // Interleaved channels
+                {322, long_type, 1, values(tile_size, 4, 1)},
+                {323, long_type, 1, values(tile_size, 4, 1)},
+                {324, offset_type, tile_count, {}},                 // Tile offsets, filled in below
+                {325, offset_type, tile_count, values(this->tile_bytes, offset_size, tile_count)},
+                {338, short_type, 1, values(2, 2, 1)},              // The fourth channel is unassociated alpha
+            };
+
+            const std::size_t header_size = this->big ? 16 : 8;
+            const std::size_t entry_size = this->big ? 20 : 12;
+            const std::size_t inline_size = this->big ? 8 : 4;
+            const std::size_t directory_size = (this->big ? 8 + 8 : 2 + 4) + entries.size() * entry_size;
+            // Values that don't fit in their entry go after the directory
+            std::size_t extra_size = 0;
+            for (const auto& entry: entries) {
+                const std::size_t size = entry.tag == 324 ? offset_size * tile_count : entry.value.size();
+                if (size > inline_size) {
+                    extra_size += size;
+                }
+            }
+            this->data_start = (header_size + directory_size + extra_size + 15) / 16 * 16;
+            for (std::size_t tile = 0; tile < tile_count; tile++) {
+                PushLittleEndian(entries[9].value, this->TileOffset(tile), offset_size);
+            }
+
+            this->head.clear();
+            this->head.insert(this->head.end(), {'I', 'I'});
+            if (this->big) {
+                PushLittleEndian(this->head, 43, 2);
+                PushLittleEndian(this->head, 8, 2);
+                PushLittleEndian(this->head, 0, 2);
+                PushLittleEndian(this->head, header_size, 8);
+                PushLittleEndian(this->head, entries.size(), 8);
+            } else {
+                PushLittleEndian(this->head, 42, 2);
+                PushLittleEndian(this->head, header_size, 4);
+                PushLittleEndian(this->head, entries.size(), 2);
+            }
+            std::vector<std::uint8_t> extra;
+            const std::size_t extra_start = header_size + directory_size;
+            for (const auto& entry: entries) {
+                PushLittleEndian(this->head, entry.tag, 2);
+                PushLittleEndian(this->head, entry.type, 2);
+                PushLittleEndian(this->head, entry.count, this->big ? 8 : 4);
+                if (entry.value.size() <= inline_size) {
+                    std::vector<std::uint8_t> value = entry.value;
+                    value.resize(inline_size, 0);
+                    this->head.insert(this->head.end(), value.begin(), value.end());
+                } else {
+                    PushLittleEndian(this->head, extra_start + extra.size(), offset_size);
+                    extra.insert(extra.end(), entry.value.begin(), entry.value.end());
+                }
+            }
+            PushLittleEndian(this->head, 0, offset_size);  // No next directory
+            this->head.insert(this->head.end(), extra.begin(), extra.end());
+            this->head.resize(this->data_start, 0);
+        }
+
+        bool big{false};
+        std::uint64_t tile_bytes{0};
+        std::uint64_t data_start{0};
+        std::vector<std::uint8_t> head;
+    };
+}
+
+void RenderTiledTIFF(const std::string& path, const SegmentBuffer& lines, const std::vector<float>& thickness,
+                     const RasterColor color, const RasterColor background, const std::size_t width,
+                     const std::size_t height, const std::size_t tile_size, const unsigned thread_count) {
+    if (tile_size == 0 || tile_size % 16 != 0) {
+        throw std::invalid_argument("TIFF tile size must be a positive multiple of 16");
+    }
+    const TileBins bins = BinLines(lines, thickness, width, height, tile_size);
+    const TiffLayout layout(width, height, tile_size, bins.Size());
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + path + " for writing");
+    }
+    file.write(reinterpret_cast<const char*>(layout.getHead().data()),
+               static_cast<std::streamsize>(layout.getHead().size()));
+
+    // Tiles finish in any order, every tile has its own place in the file
+    std::mutex file_mutex;
+    ParallelFor(bins.Size(), thread_count, [&](const std::size_t tile) {
+        const std::size_t origin_x = (tile % bins.columns) * tile_size;
+        const std::size_t origin_y = (tile / bins.columns) * tile_size;
+        Framebuffer framebuffer(tile_size, tile_size, background);
+        DrawTile(lines, thickness, color, bins, tile, width, height, framebuffer, origin_x, origin_y);
+
+        const std::lock_guard<std::mutex> lock(file_mutex);
+        file.seekp(static_cast<std::streamoff>(layout.TileOffset(tile)));
+        file.write(reinterpret_cast<const char*>(framebuffer.rgba.data()),
+                   static_cast<std::streamsize>(framebuffer.rgba.size()));
+    });
+    if (!file) {
+        throw std::runtime_error("Could not write " + path);
+    }
+}
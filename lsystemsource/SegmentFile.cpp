@@ -0,0 +1,343 @@
+#include "../include/lsystem/SegmentFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+    constexpr char magic[4] = {'L', 'S', 'E', 'G'};
+    constexpr std::uint32_t version = 1;
+    constexpr std::uint32_t flag_provenance = 1;
+    constexpr std::uint64_t header_size = 64;
+    constexpr std::uint64_t alignment = 64;
+    constexpr std::uint64_t buffer_segments = 1 << 16;  // Per array, before it goes to the file
+    constexpr float quantized_steps = 65535.0f;
+
+    std::uint64_t ElementSize(const SegmentEncoding encoding) {
+        return encoding == SegmentEncoding::Quantized16 ? 2 : 4;
+    }
+
+    std::uint64_t AlignUp(const std::uint64_t value) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Where the four coordinate arrays and the provenance start
+    std::array<std::uint64_t, 5> ArrayOffsets(const std::uint64_t data_offset, const std::uint64_t segment_count,
+                                              const SegmentEncoding encoding) {
+        const std::uint64_t stride = AlignUp(segment_count * ElementSize(encoding));
+        std::array<std::uint64_t, 5> offsets{};
+        for (std::size_t array = 0; array < offsets.size(); array++) {
+            offsets[array] = data_offset + array * stride;
+        }
+        return offsets;
+    }
+
+    bool IsXArray(const std::size_t array) {
+        return array == static_cast<std::size_t>(SegmentArray::StartX) ||
+               array == static_cast<std::size_t>(SegmentArray::EndX);
+    }
+
+    template <typename T>
+    void Put(std::uint8_t* header, const std::size_t offset, const T value) {
+        std::memcpy(header + offset, &value, sizeof(T));
+    }
+
+    template <typename T>
+    T Get(const std::uint8_t* header, const std::size_t offset) {
+        T value;
+        std::memcpy(&value, header + offset, sizeof(T));
+        return value;
+    }
+}
+
+SegmentFileWriter::SegmentFileWriter(const std::string& path, const std::uint64_t segment_count,
+                                     const TurtleBounds& bounds, const SegmentEncoding encoding, const bool provenance):
+    path(path), segment_count(segment_count), bounds(bounds), encoding(encoding), provenance(provenance),
+    offsets(ArrayOffsets(header_size, segment_count, encoding)) {
+    this->file.open(path, std::ios::binary | std::ios::trunc);
+    if (!this->file) {
+        throw std::runtime_error("Could not open " + path + " for writing");
+    }
+
+    std::array<std::uint8_t, header_size> header{};
+    std::memcpy(header.data(), magic, sizeof(magic));
+    Put<std::uint32_t>(header.data(), 4, version);
+    Put<std::uint32_t>(header.data(), 8, static_cast<std::uint32_t>(encoding));
+    Put<std::uint32_t>(header.data(), 12, provenance ? flag_provenance : 0);
+    Put<std::uint64_t>(header.data(), 16, segment_count);
+    Put<float>(header.data(), 24, bounds.min.x);
+    Put<float>(header.data(), 28, bounds.min.y);
+    Put<float>(header.data(), 32, bounds.max.x);
+    Put<float>(header.data(), 36, bounds.max.y);
+    Put<std::uint64_t>(header.data(), 40, header_size);
+    this->file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+}
+
+void SegmentFileWriter::operator()(const TurtleVector& start, const TurtleVector& end) {
+    this->Add(start, end, 0);
+}
+
+void SegmentFileWriter::Add(const TurtleVector& start, const TurtleVector& end, const std::uint64_t symbol) {
+    if (symbol > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::overflow_error("Symbol index " + std::to_string(symbol) + " doesn't fit in the segment file");
+    }
+    // One more would go over the start of the next array
+    if (this->written == this->segment_count) {
+        throw std::overflow_error("Segment file is full, the header says " + std::to_string(this->segment_count) +
+                                  " segments");
+    }
+    this->Store(static_cast<std::size_t>(SegmentArray::StartX), start.x);
+    this->Store(static_cast<std::size_t>(SegmentArray::StartY), start.y);
+    this->Store(static_cast<std::size_t>(SegmentArray::EndX), end.x);
+    this->Store(static_cast<std::size_t>(SegmentArray::EndY), end.y);
+    if (this->provenance) {
+        const auto stored = static_cast<std::uint32_t>(symbol);
+        const auto bytes = reinterpret_cast<const char*>(&stored);
+        this->buffers[4].insert(this->buffers[4].end(), bytes, bytes + sizeof(stored));
+    }
+    this->written++;
+    if (this->written - this->flushed == buffer_segments) {
+        this->FlushArrays();
+    }
+}
+
+void SegmentFileWriter::Store(const std::size_t array, const float value) {
+    std::vector<char>& buffer = this->buffers[array];
+    if (this->encoding == SegmentEncoding::Quantized16) {
+        const float min = IsXArray(array) ? this->bounds.min.x : this->bounds.min.y;
+        const float extent = IsXArray(array) ? this->bounds.Width() : this->bounds.Height();
+        const float step = extent > 0.0f ? std::round((value - min) / extent * quantized_steps) : 0.0f;
+        const auto quantized = static_cast<std::uint16_t>(std::clamp(step, 0.0f, quantized_steps));
+        const auto bytes = reinterpret_cast<const char*>(&quantized);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(quantized));
+    } else {
+        const auto bytes = reinterpret_cast<const char*>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+    }
+}
+
+void SegmentFileWriter::FlushArrays() {
+    const std::uint64_t element_size = ElementSize(this->encoding);
+    for (std::size_t array = 0; array < this->buffers.size(); array++) {
+        std::vector<char>& buffer = this->buffers[array];
+        if (buffer.empty()) {
+            continue;
+        }
+        const std::uint64_t offset = this->offsets[array] + this->flushed * (array < 4 ? element_size : 4);
+        this->file.seekp(static_cast<std::streamoff>(offset));
+        this->file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+    this->flushed = this->written;
+}
+
+void SegmentFileWriter::Finish() {
+    if (this->written != this->segment_count) {
+        throw std::invalid_argument("Segment file got " + std::to_string(this->written) + " segments, the header says " +
+                                    std::to_string(this->segment_count));
+    }
+    this->FlushArrays();
+    this->file.close();
+    if (!this->file) {
+        throw std::runtime_error("Could not write " + this->path);
+    }
+}
+
+void WriteSegmentFile(const std::string& path, const SegmentBuffer& segments, const SegmentEncoding encoding,
+                      const std::vector<std::uint32_t>* symbol_of_segment) {
+    if (symbol_of_segment != nullptr && symbol_of_segment->size() != segments.Size()) {
+        throw std::invalid_argument("Provenance needs one symbol per segment");
+    }
+    TurtleBounds bounds;
+    for (std::size_t i = 0; i < segments.Size(); i++) {
+        bounds.Add(segments.Start(i));
+        bounds.Add(segments.End(i));
+    }
+
+    SegmentFileWriter writer(path, segments.Size(), bounds, encoding, symbol_of_segment != nullptr);
+    for (std::size_t i = 0; i < segments.Size(); i++) {
+        writer.Add(segments.Start(i), segments.End(i), symbol_of_segment != nullptr ? (*symbol_of_segment)[i] : 0);
+    }
+    writer.Finish();
+}
+
+
+SegmentFile::SegmentFile(const std::string& path) {
+#if defined(_WIN32)
+    this->file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER file_size{};
+    if (this->file_handle == INVALID_HANDLE_VALUE) {
+        this->file_handle = nullptr;
+        throw std::runtime_error("Could not open " + path);
+    }
+    if (!GetFileSizeEx(this->file_handle, &file_size)) {
+        this->Unmap();
+        throw std::runtime_error("Could not open " + path);
+    }
+    this->size = static_cast<std::size_t>(file_size.QuadPart);
+    if (this->size >= header_size) {
+        this->mapping_handle = CreateFileMappingA(this->file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (this->mapping_handle != nullptr) {
+            this->data = static_cast<const std::uint8_t*>(MapViewOfFile(this->mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+#else
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat file_stat{};
+    if (descriptor < 0 || fstat(descriptor, &file_stat) != 0) {
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+        throw std::runtime_error("Could not open " + path);
+    }
+    this->size = static_cast<std::size_t>(file_stat.st_size);
+    if (this->size >= header_size) {
+        void* mapped = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        this->data = mapped == MAP_FAILED ? nullptr : static_cast<const std::uint8_t*>(mapped);
+    }
+    close(descriptor);  // The mapping stays valid
+#endif
+    if (this->size >= header_size && this->data == nullptr) {
+        this->Unmap();
+        throw std::runtime_error("Could not map " + path);
+    }
+
+    // Only the header is read, the arrays stay in the mapping
+    if (this->size < header_size || std::memcmp(this->data, magic, sizeof(magic)) != 0) {
+        this->Unmap();
+        throw std::runtime_error(path + " is not a segment file");
+    }
+    const auto file_version = Get<std::uint32_t>(this->data, 4);
+    const auto file_encoding = Get<std::uint32_t>(this->data, 8);
+    const auto flags = Get<std::uint32_t>(this->data, 12);
+    this->segment_count = Get<std::uint64_t>(this->data, 16);
+    this->bounds.min = {Get<float>(this->data, 24), Get<float>(this->data, 28)};
+    this->bounds.max = {Get<float>(this->data, 32), Get<float>(this->data, 36)};
+    const auto data_offset = Get<std::uint64_t>(this->data, 40);
+    if (file_version != version) {
+        this->Unmap();
+        throw std::runtime_error(path + " has segment file version " + std::to_string(file_version) +
+                                 ", only version " + std::to_string(version) + " is supported");
+    }
+    if (file_encoding > static_cast<std::uint32_t>(SegmentEncoding::Quantized16) ||
+        data_offset < header_size || data_offset % alignment != 0 || data_offset > this->size ||
+        this->segment_count > this->size) {
+        this->Unmap();
+        throw std::runtime_error(path + " has a broken segment file header");
+    }
+    this->encoding = static_cast<SegmentEncoding>(file_encoding);
+
+    // Every array before the last one takes a whole stride, the last one only its elements.
+    // The count is at most the file size, so the products can't overflow, and the sums are avoided.
+    const bool has_provenance = (flags & flag_provenance) != 0;
+    const std::uint64_t available = this->size - data_offset;
+    const std::uint64_t stride = AlignUp(this->segment_count * ElementSize(this->encoding));
+    const std::uint64_t arrays_before_last = has_provenance ? 4 : 3;
+    const std::uint64_t last_size = this->segment_count * (has_provenance ? 4 : ElementSize(this->encoding));
+    if (stride > available / arrays_before_last || last_size > available - arrays_before_last * stride) {
+        this->Unmap();
+        throw std::runtime_error(path + " is truncated");
+    }
+    const auto offsets = ArrayOffsets(data_offset, this->segment_count, this->encoding);
+    for (std::size_t array = 0; array < this->arrays.size(); array++) {
+        this->arrays[array] = this->data + offsets[array];
+    }
+    if (has_provenance) {
+        this->provenance = reinterpret_cast<const std::uint32_t*>(this->data + offsets[4]);
+    }
+}
+
+SegmentFile::~SegmentFile() {
+    this->Unmap();
+}
+
+SegmentFile::SegmentFile(SegmentFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+SegmentFile& SegmentFile::operator=(SegmentFile&& other) noexcept {
+    if (this != &other) {
+        this->Unmap();
+        this->data = std::exchange(other.data, nullptr);
+        this->size = std::exchange(other.size, 0);
+#if defined(_WIN32)
+        this->file_handle = std::exchange(other.file_handle, nullptr);
+        this->mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+        this->segment_count = std::exchange(other.segment_count, 0);
+        this->bounds = other.bounds;
+        this->encoding = other.encoding;
+        this->arrays = std::exchange(other.arrays, {});
+        this->provenance = std::exchange(other.provenance, nullptr);
+    }
+    return *this;
+}
+
+void SegmentFile::Unmap() {
+#if defined(_WIN32)
+    if (this->data != nullptr) {
+        UnmapViewOfFile(this->data);
+    }
+    if (this->mapping_handle != nullptr) {
+        CloseHandle(this->mapping_handle);
+    }
+    if (this->file_handle != nullptr) {
+        CloseHandle(this->file_handle);
+    }
+    this->file_handle = nullptr;
+    this->mapping_handle = nullptr;
+#else
+    if (this->data != nullptr) {
+        munmap(const_cast<std::uint8_t*>(this->data), this->size);
+    }
+#endif
+    this->data = nullptr;
+    this->size = 0;
+}
+
+const float* SegmentFile::FloatArray(const SegmentArray array) const {
+    if (this->encoding != SegmentEncoding::Float32) {
+        return nullptr;
+    }
+    return static_cast<const float*>(this->arrays[static_cast<std::size_t>(array)]);
+}
+
+const std::uint16_t* SegmentFile::QuantizedArray(const SegmentArray array) const {
+    if (this->encoding != SegmentEncoding::Quantized16) {
+        return nullptr;
+    }
+    return static_cast<const std::uint16_t*>(this->arrays[static_cast<std::size_t>(array)]);
+}
+
+float SegmentFile::Coordinate(const SegmentArray array, const std::size_t index) const {
+    if (this->encoding == SegmentEncoding::Float32) {
+        return this->FloatArray(array)[index];
+    }
+    const bool x = IsXArray(static_cast<std::size_t>(array));
+    const float min = x ? this->bounds.min.x : this->bounds.min.y;
+    const float extent = x ? this->bounds.Width() : this->bounds.Height();
+    return min + static_cast<float>(this->QuantizedArray(array)[index]) * extent / quantized_steps;
+}
+
+TurtleVector SegmentFile::Start(const std::size_t index) const {
+    return {this->Coordinate(SegmentArray::StartX, index), this->Coordinate(SegmentArray::StartY, index)};
+}
+
+TurtleVector SegmentFile::End(const std::size_t index) const {
+    return {this->Coordinate(SegmentArray::EndX, index), this->Coordinate(SegmentArray::EndY, index)};
+}
@@ -0,0 +1,178 @@
+#include "../include/lsystem/SegmentGrid.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "../include/lsystem/Parallel.hpp"
+
+
+TurtleBounds SegmentGrid::SegmentBox(const std::size_t index) const {
+    TurtleBounds box;
+    box.Add(this->segments->Start(index));
+    box.Add(this->segments->End(index));
+    return box;
+}
+
+SegmentGrid::CellRange SegmentGrid::CellsOf(const TurtleBounds& box) const {
+    const auto cell = [](const float value, const float cell_size, const std::size_t count) {
+        const float index = std::floor(value / cell_size);
+        if (index <= 0.0f) {
+            return std::size_t{0};
+        }
+        return std::min(static_cast<std::size_t>(index), count - 1);
+    };
+    return {
+        cell(box.min.x - this->bounds.min.x, this->cell_width, this->columns),
+        cell(box.max.x - this->bounds.min.x, this->cell_width, this->columns),
+        cell(box.min.y - this->bounds.min.y, this->cell_height, this->rows),
+        cell(box.max.y - this->bounds.min.y, this->cell_height, this->rows),
+    };
+}
+
+void SegmentGrid::Build(const SegmentBuffer& segment_buffer, unsigned thread_count, const float segments_per_cell) {
+    this->segments = &segment_buffer;
+    this->bounds = {};
+    for (std::size_t i = 0; i < segment_buffer.Size(); i++) {
+        this->bounds.Add(segment_buffer.Start(i));
+        this->bounds.Add(segment_buffer.End(i));
+    }
+    this->cell_indices.clear();
+    if (this->bounds.Empty()) {
+        this->columns = 0;
+        this->rows = 0;
+        this->cell_begin.assign(1, 0);
+        return;
+    }
+
+    // Square cells, as many as needed for the requested density
+    const float width = std::max(this->bounds.Width(), 1e-6f);
+    const float height = std::max(this->bounds.Height(), 1e-6f);
+    const float cell_count = std::max(1.0f, static_cast<float>(segment_buffer.Size()) / segments_per_cell);
+    const float cell_size = std::sqrt(width * height / cell_count);
+    this->columns = std::clamp<std::size_t>(static_cast<std::size_t>(std::ceil(width / cell_size)), 1, 4096);
+    this->rows = std::clamp<std::size_t>(static_cast<std::size_t>(std::ceil(height / cell_size)), 1, 4096);
+    this->cell_width = width / static_cast<float>(this->columns);
+    this->cell_height = height / static_cast<float>(this->rows);
+    const std::size_t cells = this->columns * this->rows;
+
+    // Counting sort in two passes over contiguous chunks, one chunk per thread.
+    // All chunks share one set of counters, so the memory doesn't grow with the thread count.
+    // A chunk is a contiguous part of the turtle's path, chunks mostly count in different cells.
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+    const std::size_t chunk_count = std::max<std::size_t>(1, std::min<std::size_t>(thread_count,
+                                                                                   segment_buffer.Size() / 4096));
+    const std::size_t chunk_size = (segment_buffer.Size() + chunk_count - 1) / chunk_count;
+    std::vector<std::atomic<std::uint32_t>> counts(cells);
+
+    const auto for_each_cell = [this](const std::size_t index, auto&& cell_visitor) {
+        const CellRange range = this->CellsOf(this->SegmentBox(index));
+        for (std::size_t row = range.min_row; row <= range.max_row; row++) {
+            for (std::size_t column = range.min_column; column <= range.max_column; column++) {
+                cell_visitor(row * this->columns + column);
+            }
+        }
+    };
+
+    ParallelFor(chunk_count, thread_count, [&](const std::size_t chunk) {
+        const std::size_t end = std::min(segment_buffer.Size(), (chunk + 1) * chunk_size);
+        for (std::size_t i = chunk * chunk_size; i < end; i++) {
+            for_each_cell(i, [&](const std::size_t cell) { counts[cell].fetch_add(1, std::memory_order_relaxed); });
+        }
+    });
+
+    // Counts become cell starts, the counters are reused as fill positions within the cell
+    this->cell_begin.assign(cells + 1, 0);
+    std::size_t total = 0;
+    for (std::size_t cell = 0; cell < cells; cell++) {
+        this->cell_begin[cell] = total;
+        total += counts[cell].load(std::memory_order_relaxed);
+        counts[cell].store(0, std::memory_order_relaxed);
+    }
+    this->cell_begin[cells] = total;
+    this->cell_indices.resize(total);
+
+    ParallelFor(chunk_count, thread_count, [&](const std::size_t chunk) {
+        const std::size_t end = std::min(segment_buffer.Size(), (chunk + 1) * chunk_size);
+        for (std::size_t i = chunk * chunk_size; i < end; i++) {
+            for_each_cell(i, [&](const std::size_t cell) {
+                const std::uint32_t position = counts[cell].fetch_add(1, std::memory_order_relaxed);
+                this->cell_indices[this->cell_begin[cell] + position] = static_cast<std::uint32_t>(i);
+            });
+        }
+    });
+
+    // Chunks that met in a cell filled it in any order, every cell lists its segments in order again.
+    // Cells hold a few segments each, this is cheap next to the passes above.
+    const std::size_t cells_per_chunk = (cells + chunk_count - 1) / chunk_count;
+    ParallelFor(chunk_count, thread_count, [&](const std::size_t chunk) {
+        const std::size_t end = std::min(cells, (chunk + 1) * cells_per_chunk);
+        for (std::size_t cell = chunk * cells_per_chunk; cell < end; cell++) {
+            std::sort(this->cell_indices.begin() + static_cast<std::ptrdiff_t>(this->cell_begin[cell]),
+                      this->cell_indices.begin() + static_cast<std::ptrdiff_t>(this->cell_begin[cell + 1]));
+        }
+    });
+}
+
+bool SegmentGrid::Nearest(const TurtleVector& point, const float max_distance, std::uint32_t& index) const {
+    TurtleBounds region;
+    region.Add(TurtleVector{point.x - max_distance, point.y - max_distance});
+    region.Add(TurtleVector{point.x + max_distance, point.y + max_distance});
+    if (!region.Intersects(this->bounds)) {
+        return false;
+    }
+
+    bool found = false;
+    float best = max_distance;
+    const CellRange query = this->CellsOf(region);
+    for (std::size_t row = query.min_row; row <= query.max_row; row++) {
+        for (std::size_t column = query.min_column; column <= query.max_column; column++) {
+            const std::size_t cell = row * this->columns + column;
+            for (std::size_t i = this->cell_begin[cell]; i < this->cell_begin[cell + 1]; i++) {
+                const std::uint32_t candidate = this->cell_indices[i];
+                const TurtleVector start = this->segments->Start(candidate);
+                const TurtleVector end = this->segments->End(candidate);
+                const float length_x = end.x - start.x;
+                const float length_y = end.y - start.y;
+                const float length = length_x * length_x + length_y * length_y;
+                const float t = length == 0.0f ? 0.0f : std::clamp(
+                        ((point.x - start.x) * length_x + (point.y - start.y) * length_y) / length, 0.0f, 1.0f);
+                const float distance = std::hypot(start.x + t * length_x - point.x, start.y + t * length_y - point.y);
+                // Lowest index on ties, segments in several cells are seen more than once
+                if (distance < best || (distance == best && (!found || candidate < index))) {
+                    best = distance;
+                    index = candidate;
+                    found = true;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+void SegmentGrid::Query(const TurtleBounds& region, std::vector<std::uint32_t>& indices) const {
+    indices.clear();
+    if (!region.Intersects(this->bounds)) {
+        return;
+    }
+    const CellRange query = this->CellsOf(region);
+    for (std::size_t row = query.min_row; row <= query.max_row; row++) {
+        for (std::size_t column = query.min_column; column <= query.max_column; column++) {
+            const std::size_t cell = row * this->columns + column;
+            for (std::size_t i = this->cell_begin[cell]; i < this->cell_begin[cell + 1]; i++) {
+                const std::uint32_t index = this->cell_indices[i];
+                const TurtleBounds box = this->SegmentBox(index);
+                if (!box.Intersects(region)) {
+                    continue;
+                }
+                // A segment that covers several cells is only reported by the first one the query visits
+                const CellRange range = this->CellsOf(box);
+                if (std::max(range.min_row, query.min_row) == row && std::max(range.min_column, query.min_column) == column) {
+                    indices.push_back(index);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,169 @@
+#include "../include/lsystem/SvgExport.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+    constexpr std::size_t buffer_size = 1 << 20;
+    // Polylines per path element, huge elements are slow to edit in vector editors
+    constexpr std::size_t polylines_per_path = 1024;
+}
+
+SvgWriter::SvgWriter(const std::string& path, const TurtleBounds& bounds, const float quantum,
+                     const float stroke_width, const std::string& stroke):
+    path(path), buffer(buffer_size), quantum(quantum), begin(std::chrono::steady_clock::now()) {
+    if (!(quantum > 0.0f)) {
+        throw std::invalid_argument("SVG quantum has to be positive");
+    }
+    this->file.open(path, std::ios::binary);
+    if (!this->file) {
+        throw std::runtime_error("Could not open " + path + " for writing");
+    }
+
+    // View box in quantized units, with room for the stroke around the bounds
+    const std::int64_t padding = static_cast<std::int64_t>(std::ceil(stroke_width / quantum));
+    std::int64_t min_x = 0;
+    std::int64_t min_y = 0;
+    std::int64_t width = 1;
+    std::int64_t height = 1;
+    if (!bounds.Empty()) {
+        min_x = this->Quantize(bounds.min.x) - padding;
+        min_y = this->Quantize(bounds.min.y) - padding;
+        width = std::max<std::int64_t>(1, this->Quantize(bounds.max.x) + padding - min_x);
+        height = std::max<std::int64_t>(1, this->Quantize(bounds.max.y) + padding - min_y);
+    }
+
+    this->Write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" +
+                std::to_string(static_cast<double>(width) * quantum) + "\" height=\"" +
+                std::to_string(static_cast<double>(height) * quantum) + "\" viewBox=\"" +
+                std::to_string(min_x) + " " + std::to_string(min_y) + " " +
+                std::to_string(width) + " " + std::to_string(height) + "\">\n" +
+                "<g fill=\"none\" stroke=\"" + stroke + "\" stroke-width=\"" + std::to_string(stroke_width / quantum) +
+                "\" stroke-linecap=\"round\" stroke-linejoin=\"round\">\n");
+}
+
+std::int64_t SvgWriter::Quantize(const float value) const {
+    return std::llround(static_cast<double>(value) / this->quantum);
+}
+
+void SvgWriter::operator()(const TurtleVector& start, const TurtleVector& end) {
+    this->stats.segments++;
+    const std::int64_t start_x = this->Quantize(start.x);
+    const std::int64_t start_y = this->Quantize(start.y);
+    // Rounding can put the start of a segment one unit away from the end of the previous one.
+    // The next step is taken from the quantized end, so the join error doesn't add up.
+    if (!this->open || std::abs(start_x - this->pen_x) > 1 || std::abs(start_y - this->pen_y) > 1) {
+        this->EndPolyline();
+        this->open = true;
+        this->polyline_x = start_x;
+        this->polyline_y = start_y;
+        this->pen_x = start_x;
+        this->pen_y = start_y;
+    }
+
+    const std::int64_t move_x = this->Quantize(end.x) - this->pen_x;
+    const std::int64_t move_y = this->Quantize(end.y) - this->pen_y;
+    if (move_x == 0 && move_y == 0) {
+        return;
+    }
+    // Same direction as the step before, one longer step. Exact, the steps are integers.
+    const bool same_direction = move_x * this->step_y == move_y * this->step_x &&
+                                move_x * this->step_x + move_y * this->step_y > 0;
+    if (same_direction) {
+        this->step_x += move_x;
+        this->step_y += move_y;
+    } else {
+        this->FlushStep();
+        this->step_x = move_x;
+        this->step_y = move_y;
+    }
+    this->pen_x += move_x;
+    this->pen_y += move_y;
+}
+
+void SvgWriter::FlushStep() {
+    if (this->step_x == 0 && this->step_y == 0) {
+        return;
+    }
+    // The polyline is only started once it draws something
+    if (this->polyline_pieces == 0) {
+        if (this->path_polylines == 0) {
+            this->Write("<path d=\"", 9);
+        }
+        this->Write("M", 1);
+        this->WriteInteger(this->polyline_x);
+        this->Write(" ", 1);
+        this->WriteInteger(this->polyline_y);
+        this->Write("l", 1);
+        this->path_polylines++;
+        this->stats.polylines++;
+    } else {
+        this->Write(" ", 1);
+    }
+    this->WriteInteger(this->step_x);
+    this->Write(" ", 1);
+    this->WriteInteger(this->step_y);
+    this->polyline_pieces++;
+    this->stats.pieces++;
+    this->step_x = 0;
+    this->step_y = 0;
+}
+
+void SvgWriter::EndPolyline() {
+    if (!this->open) {
+        return;
+    }
+    this->FlushStep();
+    this->open = false;
+    this->polyline_pieces = 0;
+    if (this->path_polylines == polylines_per_path) {
+        this->Write("\"/>\n", 4);
+        this->path_polylines = 0;
+    }
+}
+
+SvgStats SvgWriter::Finish() {
+    this->EndPolyline();
+    if (this->path_polylines != 0) {
+        this->Write("\"/>\n", 4);
+        this->path_polylines = 0;
+    }
+    this->Write("</g>\n</svg>\n", 12);
+    this->Flush();
+    this->file.close();
+    if (!this->file) {
+        throw std::runtime_error("Could not write " + this->path);
+    }
+    this->stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->begin).count();
+    return this->stats;
+}
+
+void SvgWriter::Write(const char* text, const std::size_t size) {
+    if (this->buffered + size > this->buffer.size()) {
+        this->Flush();
+    }
+    if (size > this->buffer.size()) {
+        this->file.write(text, static_cast<std::streamsize>(size));
+    } else {
+        std::memcpy(this->buffer.data() + this->buffered, text, size);
+        this->buffered += size;
+    }
+    this->stats.bytes += size;
+}
+
+void SvgWriter::WriteInteger(const std::int64_t value) {
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    this->Write(digits, static_cast<std::size_t>(result.ptr - digits));
+}
+
+void SvgWriter::Flush() {
+    this->file.write(this->buffer.data(), static_cast<std::streamsize>(this->buffered));
+    this->buffered = 0;
+}
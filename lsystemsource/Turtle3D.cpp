@@ -0,0 +1,104 @@
+#include "../include/lsystem/Turtle3D.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace {
+    const char cylinder_magic[4] = {'L', 'S', 'C', '3'};
+    const std::uint32_t cylinder_version = 1;
+}
+
+
+TurtleQuaternion TurtleQuaternion::FromAxisAngle(const TurtleVector3& axis, const float angle) {
+    const float half_sin = std::sin(angle / 2.0f);
+    return {std::cos(angle / 2.0f), axis.x * half_sin, axis.y * half_sin, axis.z * half_sin};
+}
+
+TurtleQuaternion TurtleQuaternion::operator*(const TurtleQuaternion& other) const {
+    return {
+        w * other.w - x * other.x - y * other.y - z * other.z,
+        w * other.x + x * other.w + y * other.z - z * other.y,
+        w * other.y - x * other.z + y * other.w + z * other.x,
+        w * other.z + x * other.y - y * other.x + z * other.w
+    };
+}
+
+TurtleVector3 TurtleQuaternion::Rotate(const TurtleVector3& vector) const {
+    // v' = v + 2w(q x v) + 2(q x (q x v))
+    const float cx = y * vector.z - z * vector.y;
+    const float cy = z * vector.x - x * vector.z;
+    const float cz = x * vector.y - y * vector.x;
+    return {
+        vector.x + 2.0f * (w * cx + y * cz - z * cy),
+        vector.y + 2.0f * (w * cy + z * cx - x * cz),
+        vector.z + 2.0f * (w * cz + x * cy - y * cx)
+    };
+}
+
+TurtleQuaternion TurtleQuaternion::Normalized() const {
+    const float length = std::sqrt(w * w + x * x + y * y + z * z);
+    return {w / length, x / length, y / length, z / length};
+}
+
+void CylinderInstance::ToMatrix(float matrix[16]) const {
+    const TurtleVector3 axis_x = rotation.Rotate({1.0f, 0.0f, 0.0f});
+    const TurtleVector3 axis_y = rotation.Rotate({0.0f, 1.0f, 0.0f});
+    const TurtleVector3 axis_z = rotation.Rotate({0.0f, 0.0f, 1.0f});
+
+    const float columns[16] = {
+        axis_x.x * radius, axis_x.y * radius, axis_x.z * radius, 0.0f,
+        axis_y.x * length, axis_y.y * length, axis_y.z * length, 0.0f,
+        axis_z.x * radius, axis_z.y * radius, axis_z.z * radius, 0.0f,
+        position.x, position.y, position.z, 1.0f
+    };
+    std::memcpy(matrix, columns, sizeof(columns));
+}
+
+void WriteCylinderInstances(const std::string& path, const std::vector<CylinderInstance>& instances) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + path + " for writing");
+    }
+    const auto count = static_cast<std::uint64_t>(instances.size());
+    file.write(cylinder_magic, sizeof(cylinder_magic));
+    file.write(reinterpret_cast<const char*>(&cylinder_version), sizeof(cylinder_version));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(instances.data()),
+               static_cast<std::streamsize>(instances.size() * sizeof(CylinderInstance)));
+    if (!file) {
+        throw std::runtime_error("Could not write " + path);
+    }
+}
+
+std::vector<CylinderInstance> ReadCylinderInstances(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[4];
+    std::uint32_t version = 0;
+    std::uint64_t count = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || std::memcmp(magic, cylinder_magic, sizeof(magic)) != 0 || version != cylinder_version) {
+        throw std::runtime_error(path + " is not a cylinder instance file");
+    }
+
+    // The count comes from the file, it has to fit in what is left before anything is allocated
+    const std::streamoff data_begin = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff remaining = file.tellg() - data_begin;
+    file.seekg(data_begin);
+    if (!file || count > static_cast<std::uint64_t>(remaining) / sizeof(CylinderInstance)) {
+        throw std::runtime_error(path + " is truncated");
+    }
+
+    std::vector<CylinderInstance> instances(count);
+    file.read(reinterpret_cast<char*>(instances.data()),
+              static_cast<std::streamsize>(count * sizeof(CylinderInstance)));
+    if (!file) {
+        throw std::runtime_error(path + " is truncated");
+    }
+    return instances;
+}
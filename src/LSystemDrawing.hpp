@@ -1,22 +1,28 @@
 #pragma once
 
-#include <queue>
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
-#include <stack>
+#include <numeric>
 
-#include "raylib.h"
+#include "../include/lsystem/Turtle.hpp"
+#include "../include/lsystem/SegmentBuffer.hpp"
+#include "../include/lsystem/ParallelTurtle.hpp"
+#include "../include/lsystem/TurtleBounds.hpp"
+#include "../include/lsystem/DerivationTables.hpp"
+#include "../include/lsystem/Polyline.hpp"
+#include "../include/lsystem/SegmentGrid.hpp"
+#include "../include/lsystem/RenderBackend.hpp"
 
-template <typename SymbolType>
-struct DrawRuleStruct {
-    const SymbolType symbolType{};
-
-    float draw_line_size{0};
-    bool end_this_branch{false};
-    float turn_angle{0}; // Positive or negative angle, in radians
+// How far a progressive drawing got, see `LSystemDrawing::DrawVisibleProgressive`
+struct DrawProgress {
+    bool restarted{false};   // The image started over in this call, the backend was cleared
+    std::size_t drawn{0};    // Lines drawn so far, over all calls
+    std::size_t total{0};    // Lines in the whole image
+    double seconds{0.0};     // Time spent in this call
 
-    bool push_fifo{};
-    bool pop_fifo{};
+    bool Done() const { return drawn == total; }
 };
 
 template <typename SymbolType>
@@ -26,70 +32,317 @@ public:
     LSystemDrawing(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules, float screen_width, float screen_height);
 
     DrawRuleStruct<SymbolType> DrawruleFromSymbol(const SymbolType& symbol) const;
-    void Draw(const std::vector<SymbolType>& input, float size_multiplier = 1.0);
+
+    // Draws the input, every line goes to `backend.Line(start, end, thickness)` in screen space
+    // (see RenderBackend.hpp, RaylibBackend for the window). The turtle runs once, later calls draw the
+    // cached segments until `Invalidate` is called or the size multiplier changes, so a frame doesn't
+    // touch the input at all. Call `Invalidate` whenever the input changed, in place or for another vector.
+    template <typename Backend>
+    void Draw(Backend& backend, const std::vector<SymbolType>& input, float size_multiplier = 1.0);
+
+    // Draws the on screen part of a generation without deriving it: the subtree tables are walked
+    // from the axiom and subtrees outside the view are skipped, so the cost follows what is visible
+    // (generation 20+ when zoomed in). Segments are cached until the view or the tables change,
+    // the tables are recognised by their address.
+    template <typename Backend>
+    void DrawVisible(Backend& backend, const DerivationTables<SymbolType>& tables);
+
+    // Time sliced version of `DrawVisible`, for frames that have to stay fast whatever the generation.
+    // Draws for about `budget_seconds` per call, longest lines first so the shape shows up early,
+    // and continues where the previous call stopped. The backend has to keep what was drawn between calls
+    // (a render texture for raylib). When the segments or the view change, the image starts over
+    // and `backend.Clear()` is called first. Only the drawing is time sliced: after a view change the
+    // call first expands the visible subtrees, simplifies their polylines and orders the pieces, in full
+    // and outside the budget, so that call takes as long as the visible part of the generation needs.
+    // Callers that redraw on every pan frame should keep showing the previous image until `Done()`.
+    template <typename Backend>
+    DrawProgress DrawVisibleProgressive(Backend& backend, const DerivationTables<SymbolType>& tables,
+                                        double budget_seconds);
+
+    // Quick preview of huge generations: `count` segments picked uniformly from the whole generation
+    // (see `DerivationTables::SampleSegments`), drawn straight to the backend without caching
+    template <typename Backend>
+    void DrawSampled(Backend& backend, const DerivationTables<SymbolType>& tables, std::uint64_t count,
+                     std::uint64_t seed = 0) const;
+
+    // Level of detail for `DrawVisible`: subtrees smaller than this many pixels are drawn as a single line.
+    // 0 draws every segment.
+    void SetDetailThreshold(const float pixels) { detail_threshold = pixels; }
+    float getDetailThreshold() const { return detail_threshold; }
+
+    // Segments are merged into polylines before drawing, points that are less than this many pixels
+    // off a straight line are dropped (see `PolylineBuilder`). 0 only joins exactly collinear segments.
+    void SetSimplifyTolerance(const float pixels) { simplify_tolerance = pixels; Invalidate(); }
+
+    void SetDrawRules(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules);
+    void Invalidate() { cache_valid = false; }
+
+    // Where turtle space ends up on the screen, see `FitView` to fit a generation
+    void SetView(const TurtleView& new_view) { view = new_view; }
+    const TurtleView& getView() const { return view; }
+
+    // The turtle logic, usable without a backend
+    const Turtle<SymbolType>& getTurtle() const { return turtle; }
+    const SegmentBuffer& getSegments() const { return segments; }
+    const PolylineBuffer& getPolylines() const { return polylines; }
 private:
+    // Runs the turtle if the cached segments don't belong to this input
+    void UpdateSegments(const std::vector<SymbolType>& input, float size_multiplier);
+    void UpdateVisibleSegments(const DerivationTables<SymbolType>& tables);
+    void UpdatePolylines();
+    // Fills `visible` with the pieces that are on screen
+    void FindVisiblePieces();
+    template <typename Backend>
+    void DrawSegments(Backend& backend);
+
+    // Thinner lines when zoomed out, so dense generations stay readable
+    float Thickness() const { return std::max(1.0f, line_thickness * std::min(1.0f, view.scale)); }
+    // Turtle space on screen, with room for the thickness of lines just outside it
+    TurtleBounds VisibleRegion() const;
+
     const float line_thickness{5.0f};
     const float screen_width{};
     const float screen_height{};
 
-    std::vector<DrawRuleStruct<SymbolType>> draw_rules;
+    Turtle<SymbolType> turtle;
+    TurtleView view;
+    float detail_threshold{1.0f};
+    float simplify_tolerance{0.5f};
+
+    // Cache
+    SegmentBuffer segments;
+    PolylineBuffer polylines;
+    float polyline_scale{0};  // View scale the polylines were simplified for
+    // What gets drawn: the polyline pieces, indexed so a frame only touches the visible ones
+    SegmentBuffer pieces;
+    // Only whole generations (`Draw`) get a grid, the pieces of `DrawVisible` are already culled by the expansion
+    // and change with every view, an index would be built for a single query
+    SegmentGrid grid;
+    bool pieces_indexed{false};
+    std::vector<std::uint32_t> visible;
+    std::size_t pieces_version{0};  // Goes up whenever the pieces change
+    static constexpr int length_class_count = 32;
+    std::vector<std::uint8_t> piece_length_class;
+
+    // Progressive drawing, the visible pieces in drawing order and how far it got
+    std::vector<std::uint32_t> progressive_order;
+    std::size_t progressive_next{0};
+    std::size_t progressive_version{0};
+    TurtleView progressive_view;
+    bool progressive_valid{false};
+    bool cache_valid{false};
+    bool cached_input_valid{false};
+    float cached_size_multiplier{0};
+    const DerivationTables<SymbolType>* cached_tables{nullptr};
+    TurtleView cached_view;
+    float cached_detail_threshold{0};
 };
 
 template<typename SymbolType>
-LSystemDrawing<SymbolType>::LSystemDrawing(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules, float screen_width, float screen_height): draw_rules(draw_rules), screen_height(screen_height), screen_width(screen_width) {
+LSystemDrawing<SymbolType>::LSystemDrawing(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules, float screen_width, float screen_height):
+    screen_width(screen_width), screen_height(screen_height), turtle(draw_rules, {screen_width / 2, screen_height - 20.0f}) {
 
 }
 
 template<typename SymbolType>
 DrawRuleStruct<SymbolType> LSystemDrawing<SymbolType>::DrawruleFromSymbol(const SymbolType &symbol) const {
-    const auto draw_rule_iter = std::find_if(this->draw_rules.begin(), this->draw_rules.end(),
-                                          [symbol](const DrawRuleStruct<SymbolType>& rule_struct) { return symbol == rule_struct.symbolType;
-        }
-    );
-    if (draw_rule_iter == this->draw_rules.end()) {
+    const auto* draw_rule = this->turtle.DrawruleFromSymbol(symbol);
+    if (draw_rule == nullptr) {
         return {};
     }
-    return *draw_rule_iter;
+    return *draw_rule;
+}
+
+template<typename SymbolType>
+void LSystemDrawing<SymbolType>::SetDrawRules(const std::vector<DrawRuleStruct<SymbolType>>& draw_rules) {
+    this->turtle = Turtle<SymbolType>(draw_rules, this->turtle.getOrigin());
+    this->Invalidate();
+}
+
+template<typename SymbolType>
+void LSystemDrawing<SymbolType>::UpdateSegments(const std::vector<SymbolType>& input, const float size_multiplier) {
+    if (this->cache_valid && this->cached_input_valid && this->cached_size_multiplier == size_multiplier) {
+        return;
+    }
+
+    InterpretParallel(this->turtle, input, size_multiplier, this->segments);
+    this->pieces_indexed = true;
+    this->UpdatePolylines();
+
+    this->cache_valid = true;
+    this->cached_input_valid = true;
+    this->cached_size_multiplier = size_multiplier;
+    this->cached_tables = nullptr;
 }
 
 template<typename SymbolType>
-void LSystemDrawing<SymbolType>::Draw(const std::vector<SymbolType>& input, const float size_multiplier) {
-    // Working variables
-    std::stack<std::pair<Vector2, float>> lifo{};
-    Vector2 current_pos = {screen_width / 2, screen_height - 20.0f};
-    float current_angle = 0;
-
-    // Drawing
-    for (const auto &symbol: input) {
-        auto draw_rule = this->DrawruleFromSymbol(symbol);
-        auto line_size = draw_rule.draw_line_size * size_multiplier;
-
-        // Fifo
-        if (draw_rule.push_fifo) {
-            lifo.emplace(current_pos, current_angle);
+void LSystemDrawing<SymbolType>::UpdateVisibleSegments(const DerivationTables<SymbolType>& tables) {
+    if (this->cache_valid && this->cached_tables == &tables && this->cached_view == this->view &&
+        this->cached_detail_threshold == this->detail_threshold) {
+        return;
+    }
+
+    this->segments.Clear();
+    tables.ExpandVisible(this->view.Visible(this->screen_width, this->screen_height),
+                         this->detail_threshold / this->view.scale, [this](const TurtleVector& start, const TurtleVector& end) {
+        this->segments.Add(start, end);
+    });
+    this->pieces_indexed = false;
+    this->UpdatePolylines();
+
+    this->cache_valid = true;
+    this->cached_tables = &tables;
+    this->cached_view = this->view;
+    this->cached_detail_threshold = this->detail_threshold;
+    this->cached_input_valid = false;
+}
+
+template<typename SymbolType>
+void LSystemDrawing<SymbolType>::UpdatePolylines() {
+    // The tolerance is in pixels, the polylines in turtle space
+    this->polylines.Clear();
+    PolylineBuilder builder(this->polylines, this->simplify_tolerance / this->view.scale);
+    for (std::size_t i = 0; i < this->segments.Size(); i++) {
+        builder(this->segments.Start(i), this->segments.End(i));
+    }
+    builder.Finish();
+    this->polyline_scale = this->view.scale;
+
+    this->pieces = PolylinePieces(this->polylines);
+    if (this->pieces_indexed) {
+        this->grid.Build(this->pieces);
+    }
+    this->pieces_version++;
+
+    // Length class of every piece for progressive drawing, computed once here so a restart only has to
+    // count and scatter: class 0 holds the longest pieces, every class is half as long (in squared length)
+    float longest = 0.0f;
+    std::vector<float> squared_length(this->pieces.Size());
+    for (std::size_t i = 0; i < this->pieces.Size(); i++) {
+        const TurtleVector start = this->pieces.Start(i);
+        const TurtleVector end = this->pieces.End(i);
+        squared_length[i] = (end.x - start.x) * (end.x - start.x) + (end.y - start.y) * (end.y - start.y);
+        longest = std::max(longest, squared_length[i]);
+    }
+    this->piece_length_class.resize(this->pieces.Size());
+    for (std::size_t i = 0; i < this->pieces.Size(); i++) {
+        const int below_longest = squared_length[i] > 0.0f ? std::ilogb(longest) - std::ilogb(squared_length[i]) :
+                                                             length_class_count - 1;
+        this->piece_length_class[i] = static_cast<std::uint8_t>(std::clamp(below_longest, 0, length_class_count - 1));
+    }
+}
+
+template<typename SymbolType>
+template<typename Backend>
+void LSystemDrawing<SymbolType>::Draw(Backend& backend, const std::vector<SymbolType>& input, const float size_multiplier) {
+    this->UpdateSegments(input, size_multiplier);
+    if (this->polyline_scale != this->view.scale) {
+        this->UpdatePolylines();
+    }
+    this->DrawSegments(backend);
+}
+
+template<typename SymbolType>
+template<typename Backend>
+void LSystemDrawing<SymbolType>::DrawVisible(Backend& backend, const DerivationTables<SymbolType>& tables) {
+    this->UpdateVisibleSegments(tables);
+    this->DrawSegments(backend);
+}
+
+template<typename SymbolType>
+void LSystemDrawing<SymbolType>::FindVisiblePieces() {
+    if (this->pieces_indexed) {
+        this->grid.Query(this->VisibleRegion(), this->visible);
+        return;
+    }
+    this->visible.resize(this->pieces.Size());
+    std::iota(this->visible.begin(), this->visible.end(), 0);
+}
+
+template<typename SymbolType>
+TurtleBounds LSystemDrawing<SymbolType>::VisibleRegion() const {
+    TurtleBounds region = this->view.Visible(this->screen_width, this->screen_height);
+    const float margin = this->Thickness() / this->view.scale;
+    region.min = {region.min.x - margin, region.min.y - margin};
+    region.max = {region.max.x + margin, region.max.y + margin};
+    return region;
+}
+
+template<typename SymbolType>
+template<typename Backend>
+DrawProgress LSystemDrawing<SymbolType>::DrawVisibleProgressive(Backend& backend, const DerivationTables<SymbolType>& tables,
+                                                                const double budget_seconds) {
+    const auto begin = std::chrono::steady_clock::now();
+    this->UpdateVisibleSegments(tables);
+
+    DrawProgress progress;
+    if (!this->progressive_valid || this->progressive_version != this->pieces_version ||
+        !(this->progressive_view == this->view)) {
+        // Coarse to fine by length class, a counting sort: linear in the visible pieces
+        this->FindVisiblePieces();
+        std::array<std::size_t, length_class_count + 1> class_begin{};
+        for (const auto index: this->visible) {
+            class_begin[this->piece_length_class[index] + 1]++;
         }
-        if (draw_rule.pop_fifo) {
-            auto[saved_pos, saved_angle] = lifo.top();
-            current_pos = saved_pos;
-            current_angle = saved_angle;
-            lifo.pop();
+        for (std::size_t length_class = 1; length_class < class_begin.size(); length_class++) {
+            class_begin[length_class] += class_begin[length_class - 1];
         }
+        this->progressive_order.resize(this->visible.size());
+        for (const auto index: this->visible) {
+            this->progressive_order[class_begin[this->piece_length_class[index]]++] = index;
+        }
+        this->progressive_next = 0;
+        this->progressive_version = this->pieces_version;
+        this->progressive_view = this->view;
+        this->progressive_valid = true;
+        backend.Clear();
+        progress.restarted = true;
+    }
 
-        // Constructing next position
-        const float angle = current_angle + draw_rule.turn_angle;
-        const float x_diff = line_size * sinf(angle);
-        const float y_diff = line_size * cosf(angle);
-        const Vector2 next_pos = {current_pos.x + x_diff, current_pos.y - y_diff};
-
-        // Drawing line
-        DrawLineEx(
-                next_pos, current_pos, this->line_thickness, DARKGRAY
-                );
-
-        // Saving state
-        if (not draw_rule.end_this_branch) {
-            current_angle = angle;
-            current_pos = next_pos;
+    // The clock is only read every few lines, a line costs far less than reading it.
+    // At least one chunk per call, so the image always gets finished.
+    const float thickness = this->Thickness();
+    const std::size_t lines_per_check = 64;
+    const auto elapsed = [&begin]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    while (this->progressive_next < this->progressive_order.size()) {
+        const std::size_t end = std::min(this->progressive_order.size(), this->progressive_next + lines_per_check);
+        for (; this->progressive_next < end; this->progressive_next++) {
+            const std::uint32_t index = this->progressive_order[this->progressive_next];
+            backend.Line(this->view.ToScreen(this->pieces.Start(index)), this->view.ToScreen(this->pieces.End(index)),
+                         thickness);
         }
+        if (elapsed() >= budget_seconds) {
+            break;
+        }
+    }
+
+    progress.drawn = this->progressive_next;
+    progress.total = this->progressive_order.size();
+    progress.seconds = elapsed();
+    return progress;
+}
+
+template<typename SymbolType>
+template<typename Backend>
+void LSystemDrawing<SymbolType>::DrawSampled(Backend& backend, const DerivationTables<SymbolType>& tables,
+                                             const std::uint64_t count, const std::uint64_t seed) const {
+    const float thickness = this->Thickness();
+    tables.SampleSegments(count, seed, [&](const TurtleVector& start, const TurtleVector& end) {
+        backend.Line(this->view.ToScreen(start), this->view.ToScreen(end), thickness);
+    });
+}
+
+template<typename SymbolType>
+template<typename Backend>
+void LSystemDrawing<SymbolType>::DrawSegments(Backend& backend) {
+    const float thickness = this->Thickness();
+    this->FindVisiblePieces();
+
+    for (const auto index: this->visible) {
+        const TurtleVector start = this->view.ToScreen(this->pieces.Start(index));
+        const TurtleVector end = this->view.ToScreen(this->pieces.End(index));
+        backend.Line(start, end, thickness);
     }
 }
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "raylib.h"
+#include "../include/lsystem/Turtle.hpp"
+
+
+// Render backend (see RenderBackend.hpp) that draws straight to the raylib window
+struct RaylibBackend {
+    Color color{DARKGRAY};
+    Color background{RAYWHITE};
+
+    void Line(const TurtleVector& start, const TurtleVector& end, const float thickness) const {
+        DrawLineEx({start.x, start.y}, {end.x, end.y}, thickness, color);
+    }
+
+    void Clear() const { ClearBackground(background); }
+};
@@ -1,8 +1,17 @@
 #include <vector>
 #include <unordered_set>
+#include <memory>
+#include <chrono>
+#include <utility>
 #include "raylib.h"
 #include "../include/lsystem/LSystemInterpreter.hpp"
+#include "../include/lsystem/CompiledLSystem.hpp"
+#include "../include/lsystem/DerivationTables.hpp"
+#include "../include/lsystem/Density.hpp"
+#include "../include/lsystem/SvgExport.hpp"
+#include "../include/lsystem/SegmentFile.hpp"
 #include "LSystemDrawing.hpp"
+#include "RaylibBackend.hpp"
 
 #if defined(PLATFORM_WEB)
 #include <emscripten/emscripten.h>
@@ -11,7 +20,7 @@
 //----------------------------------------------------------------------------------
 // Global Variables Definition
 //----------------------------------------------------------------------------------
-const float pi = 3.14;
+const float pi = 3.14159265f;
 
 int screenWidth = 800;
 int screenHeight = 450;
@@ -24,7 +33,7 @@ void UpdateDrawFrame();     // Update and Draw one frame
 //----------------------------------------------------------------------------------
 // Main Entry Point
 //----------------------------------------------------------------------------------
-int main() {
+int main(int argc, char** argv) {
     // Initialization
     //--------------------------------------------------------------------------------------
     InitWindow(screenWidth, screenHeight, "LSystemVisualizer");
@@ -45,6 +54,7 @@ int main() {
                 Production<CharType>("0", {"1", "[", "0", "]", "0"})
         };
         LSystemInterpreter<CharType> lsystem = LSystemInterpreter(axiom, productions, alphabet);
+        const CompiledLSystem<CharType> compiled_lsystem(lsystem);
 
         // Draw
         const std::vector<DrawRuleStruct<CharType>>draw_rules{
@@ -72,16 +82,65 @@ int main() {
         };
 
         std::size_t current_state_index = 0;
-        std::vector<std::vector<CharType>> saved_states{axiom};
         LSystemDrawing<CharType> lsystem_drawing = LSystemDrawing<CharType>(draw_rules, static_cast<float>(screenWidth), static_cast<float>(screenHeight));
+        RaylibBackend backend;
+
+        // Generations are never derived, they are drawn from the subtree tables, which stay small
+        // at any depth. Only rebuilt when the generation changes.
+        std::unique_ptr<DerivationTables<CharType>> tables;
+        std::string state_string;
+        float state_font_size = 16.0f;
+        std::size_t state_string_index = SIZE_MAX;
+        bool fit_view = true;
+        const std::uint64_t max_state_string_length = 2048;  // Symbols, longer generations only show their size
+
+        // Density mode (D), for generations where single lines only overdraw each other.
+        // Recomputed when the view or the generation changes, shown as one texture.
+        bool density_mode = false;
+        bool density_valid = false;
+        TurtleView density_view;
+        DensityBuffer density(screenWidth, screenHeight);
+        Framebuffer density_image(screenWidth, screenHeight, {245, 245, 245, 255});
+        const Texture2D density_texture = LoadTextureFromImage(
+                {density_image.rgba.data(), screenWidth, screenHeight, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8});
+
+        // Sample mode (S), a fixed number of segments picked uniformly from the generation, every frame
+        bool sample_mode = false;
+        const std::uint64_t sample_count = 20000;
+
+        // E exports the whole generation as SVG, at full detail whatever the view
+        const std::string export_path = "lsystem.svg";
+
+        // W writes the whole generation as a segment file. A segment file given on the command line
+        // is shown instead of the L-system, mapped and drawn as density.
+        const std::string segment_path = "lsystem.lseg";
+        std::unique_ptr<SegmentFile> segment_file;
+        std::string export_status;
+        if (argc > 1) {
+            try {
+                segment_file = std::make_unique<SegmentFile>(argv[1]);
+            } catch (const std::runtime_error& error) {
+                export_status = error.what();  // Shows the L-system instead
+            }
+        }
+
+        // Lines are drawn progressively into a render texture, a few milliseconds per frame,
+        // so the window stays responsive while a big generation fills in.
+        // Until a new image is finished, the last finished one is shown under it, moved to the current view,
+        // so panning and zooming never show an empty window.
+        const double frame_budget = 0.008;  // Seconds
+        RenderTexture2D canvas = LoadRenderTexture(screenWidth, screenHeight);
+        RenderTexture2D finished = LoadRenderTexture(screenWidth, screenHeight);
+        TurtleView finished_view;
+        bool has_finished = false;
+        bool canvas_pending = false;  // The canvas holds an image that isn't finished yet
+        backend.background = BLANK;  // The canvas goes on top of the finished image
+        DrawProgress progress;
 
         while (!WindowShouldClose())    // Detect window close button or ESC key
         {
             // Handle Input
             if (IsKeyReleased(KEY_RIGHT)) {
-                if (current_state_index == (saved_states.size() - 1)) {
-                    saved_states.emplace_back(lsystem());
-                }
                 current_state_index += 1;
             }
             if (IsKeyReleased(KEY_LEFT)) {
@@ -89,39 +148,215 @@ int main() {
                     current_state_index -= 1;
                 }
             }
+            if (IsKeyReleased(KEY_D)) {
+                density_mode = !density_mode;
+                sample_mode = false;
+            }
+            if (IsKeyReleased(KEY_S)) {
+                sample_mode = !sample_mode;
+                density_mode = false;
+            }
+            if (segment_file) {
+                density_mode = true;
+                sample_mode = false;
+            }
+            //! Camera, wheel zooms around the cursor, dragging pans, F fits the generation again
+            const Vector2 mouse = GetMousePosition();
+            const float wheel = GetMouseWheelMove();
+            if (wheel != 0.0f) {
+                lsystem_drawing.SetView(lsystem_drawing.getView().ZoomedAt({mouse.x, mouse.y}, powf(1.25f, wheel)));
+            }
+            if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+                const Vector2 delta = GetMouseDelta();
+                lsystem_drawing.SetView(lsystem_drawing.getView().Panned({delta.x, delta.y}));
+            }
+            //! Level of detail, - and = halve and double the pixel size below which subtrees become one line,
+            //! 0 turns it off and draws every segment
+            if (IsKeyReleased(KEY_MINUS)) {
+                const float threshold = lsystem_drawing.getDetailThreshold();
+                lsystem_drawing.SetDetailThreshold(threshold > 0.125f ? threshold / 2.0f : 0.0f);
+            }
+            if (IsKeyReleased(KEY_EQUAL)) {
+                lsystem_drawing.SetDetailThreshold(std::max(0.125f, lsystem_drawing.getDetailThreshold() * 2.0f));
+            }
+            if (IsKeyReleased(KEY_ZERO)) {
+                lsystem_drawing.SetDetailThreshold(0.0f);
+            }
+
             // Update
-            const auto current_state = saved_states.at(current_state_index);
+            if (current_state_index != state_string_index) {
+                const float size_multiplier = powf(0.75, static_cast<float>(current_state_index));
+                tables = std::make_unique<DerivationTables<CharType>>(compiled_lsystem, lsystem_drawing.getTurtle(),
+                                                                      current_state_index, size_multiplier);
+                lsystem_drawing.Invalidate();
+                density_valid = false;
+
+                state_string.clear();
+                if (tables->getLength() <= max_state_string_length) {
+                    compiled_lsystem.Expand(current_state_index, [&](const std::uint32_t id) {
+                        state_string += " " + compiled_lsystem.getSymbol(id);
+                    });
+                    state_font_size = 16.0f * powf(0.9, static_cast<float>(current_state_index));
+                } else {
+                    state_string = " " + std::to_string(tables->getLength()) + " symbols";
+                    state_font_size = 16.0f;
+                }
+                if (segment_file) {
+                    state_string = std::string(" ") + argv[1] + ": " + std::to_string(segment_file->Size()) + " segments";
+                    state_font_size = 16.0f;
+                }
+                state_string_index = current_state_index;
+                fit_view = true;
+            }
+            if (IsKeyReleased(KEY_E)) {
+                try {
+                    SvgWriter writer(export_path, tables->getBounds(), 0.01f);
+                    tables->Expand(writer);
+                    const SvgStats stats = writer.Finish();
+                    export_status = export_path + ": " + std::to_string(stats.segments) + " segments, " +
+                                    std::to_string(stats.bytes / 1024) + " KiB, " +
+                                    std::to_string(static_cast<int>(stats.seconds * 1000.0)) + " ms";
+                } catch (const std::runtime_error& error) {
+                    export_status = error.what();
+                }
+            }
+            if (IsKeyReleased(KEY_W)) {
+                try {
+                    const auto begin = std::chrono::steady_clock::now();
+                    SegmentFileWriter writer(segment_path, tables->getSegmentCount(), tables->getBounds());
+                    tables->Expand(writer);
+                    writer.Finish();
+                    const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - begin).count();
+                    export_status = segment_path + ": " + std::to_string(tables->getSegmentCount()) + " segments, " +
+                                    std::to_string(milliseconds) + " ms";
+                } catch (const std::exception& error) {  // Also a segment count that doesn't match the header
+                    export_status = error.what();
+                }
+            }
+            if (fit_view || IsKeyReleased(KEY_F)) {
+                // The bounds come from the subtree tables (or the file header) without drawing anything
+                lsystem_drawing.SetView(FitView(segment_file ? segment_file->getBounds() : tables->getBounds(),
+                                                static_cast<float>(screenWidth), static_cast<float>(screenHeight), 20.0f));
+                fit_view = false;
+            }
+
+            if (!density_mode && !sample_mode) {
+                BeginTextureMode(canvas);
+                progress = lsystem_drawing.DrawVisibleProgressive(backend, *tables, frame_budget);
+                EndTextureMode();
+                canvas_pending = canvas_pending || progress.restarted;
+                if (canvas_pending && progress.Done()) {
+                    std::swap(canvas, finished);
+                    finished_view = lsystem_drawing.getView();
+                    has_finished = true;
+                    canvas_pending = false;
+                }
+            }
 
             // Draw
             //----------------------------------------------------------------------------------
             BeginDrawing();
             ClearBackground(RAYWHITE); // Always required
 
-            //! Current stats
-            std::string state_string;
-            for (const auto& substring: current_state) {
-                state_string += " " + substring;
+            //! Tree
+            if (density_mode) {
+                if (!density_valid || !(density_view == lsystem_drawing.getView())) {
+                    density_view = lsystem_drawing.getView();
+                    density.Clear();
+                    const TurtleBounds visible = density_view.Visible(static_cast<float>(screenWidth),
+                                                                      static_cast<float>(screenHeight));
+                    if (segment_file) {
+                        // Ranges of the file on separate threads, segments that are off screen are only tested
+                        const std::size_t parts = 8 * DefaultThreadCount();
+                        const std::size_t part_size = (segment_file->Size() + parts - 1) / parts;
+                        AccumulateDensityParts(parts, density, 0, [&](const std::size_t part, DensityBuffer& target) {
+                            DensitySink sink(target, density_view);
+                            const std::size_t first = std::min<std::size_t>(segment_file->Size(), part * part_size);
+                            const std::size_t last = std::min<std::size_t>(segment_file->Size(), first + part_size);
+                            segment_file->ForEach(first, last, [&](const TurtleVector& start, const TurtleVector& end) {
+                                TurtleBounds segment;
+                                segment.Add(start);
+                                segment.Add(end);
+                                if (segment.Intersects(visible)) {
+                                    sink(start, end);
+                                }
+                            });
+                        });
+                    } else {
+                        // The visible subtrees are spread over the threads, each into a buffer of its own
+                        const std::vector<PlacedSubtree> parts = tables->SplitVisible(visible, 0.0f, 8 * DefaultThreadCount());
+                        AccumulateDensityParts(parts.size(), density, 0, [&](const std::size_t part, DensityBuffer& target) {
+                            tables->ExpandVisible(parts[part], visible, 0.0f, DensitySink(target, density_view));
+                        });
+                    }
+                    ToneMapDensity(density, {245, 245, 245, 255}, {80, 80, 80, 255}, 4.0f, density_image);
+                    UpdateTexture(density_texture, density_image.rgba.data());
+                    density_valid = true;
+                }
+                DrawTexture(density_texture, 0, 0, WHITE);
+            } else if (sample_mode) {
+                lsystem_drawing.DrawSampled(backend, *tables, sample_count);
+            } else {
+                // Render textures are upside down
+                const Rectangle screen{0.0f, 0.0f, static_cast<float>(screenWidth), -static_cast<float>(screenHeight)};
+                if (has_finished) {
+                    // Scaled and moved from the view it was drawn in to the current one
+                    const TurtleView& view = lsystem_drawing.getView();
+                    const float factor = view.scale / finished_view.scale;
+                    DrawTexturePro(finished.texture, screen,
+                                   {view.offset.x - finished_view.offset.x * factor, view.offset.y - finished_view.offset.y * factor,
+                                    static_cast<float>(screenWidth) * factor, static_cast<float>(screenHeight) * factor},
+                                   {0.0f, 0.0f}, 0.0f, WHITE);
+                }
+                if (canvas_pending) {
+                    DrawTextureRec(canvas.texture, screen, {0.0f, 0.0f}, WHITE);
+                }
             }
+
+            //! Current stats
             const char* stats_char = state_string.c_str();
-            DrawTextEx(GetFontDefault() ,stats_char, {4.0, 50.0},
-                       16.0f * powf(0.9, static_cast<float>(current_state_index)), 0.5, DARKGRAY);
+            DrawTextEx(GetFontDefault() ,stats_char, {4.0, 50.0}, state_font_size, 0.5, DARKGRAY);
 
             //! Root
-            DrawRectangleV(
-                    {static_cast<float>(screenWidth / 2.0) - 10.0f, static_cast<float>(screenHeight) - 20.0f},
-                    {20.0f, 20.0f}, MAROON
-                    );
+            const TurtleVector root = lsystem_drawing.getView().ToScreen(lsystem_drawing.getTurtle().getOrigin());
+            DrawRectangleV({root.x - 10.0f, root.y}, {20.0f, 20.0f}, MAROON);
 
-            //! Tree
-            lsystem_drawing.Draw(current_state, powf(0.75, static_cast<float>(current_state_index)));
+            //! Hover, which symbol drew the segment under the cursor and which productions led to it
+            SegmentPick pick;
+            const float pick_distance = 6.0f / lsystem_drawing.getView().scale;
+            if (!segment_file && tables->PickSegment(lsystem_drawing.getView().ToTurtle({mouse.x, mouse.y}), pick_distance, pick)) {
+                const TurtleVector start = lsystem_drawing.getView().ToScreen(pick.start);
+                const TurtleVector end = lsystem_drawing.getView().ToScreen(pick.end);
+                DrawLineEx({start.x, start.y}, {end.x, end.y}, 4.0f, RED);
 
+                std::string path;
+                for (const auto node_index: tables->DerivationPath(pick.symbol)) {
+                    const SubtreeNode& node = tables->getNode(node_index);
+                    path += (path.empty() ? "" : " > ") + compiled_lsystem.getSymbol(node.symbol) +
+                            "@" + std::to_string(node.depth);
+                }
+                const std::string hover = "symbol " + std::to_string(pick.symbol) +
+                                          ", segment " + std::to_string(pick.segment) + "\n" + path;
+                DrawText(hover.c_str(), static_cast<int>(mouse.x) + 12, static_cast<int>(mouse.y) + 12, 10, MAROON);
+            }
 
             //! Utilities
             DrawFPS(4, 4);
+            if (!density_mode && !sample_mode) {
+                const std::string budget = std::to_string(progress.total == 0 ? 100 : 100 * progress.drawn / progress.total) +
+                                           "% drawn, " + std::to_string(static_cast<int>(progress.seconds * 1000.0)) + "/" +
+                                           std::to_string(static_cast<int>(frame_budget * 1000.0)) + " ms";
+                DrawText(budget.c_str(), 4, 28, 10, DARKGRAY);
+            }
+            DrawText(export_status.c_str(), 4, 38, 10, DARKGRAY);
 
             EndDrawing();
             //----------------------------------------------------------------------------------
         }
+        UnloadTexture(density_texture);
+        UnloadRenderTexture(canvas);
+        UnloadRenderTexture(finished);
     #endif
 
     // De-Initialization
@@ -0,0 +1,355 @@
+#include "catch2/catch.hpp"
+
+#include <unordered_set>
+#include <vector>
+#include "lsystem/LSystemInterpreter.hpp"
+#include "lsystem/CompiledLSystem.hpp"
+#include "lsystem/Turtle.hpp"
+#include "lsystem/SegmentBuffer.hpp"
+#include "lsystem/StreamingTurtle.hpp"
+#include "lsystem/DerivationTables.hpp"
+#include "lsystem/SegmentGrid.hpp"
+
+
+namespace {
+    using TestType = std::string;
+
+    // The tree from the visualiser
+    LSystemInterpreter<TestType> TreeLSystem() {
+        const std::vector<TestType> axiom = {"0"};
+        std::unordered_set<Production<TestType>> productions{
+                Production<TestType>("1", {"1", "1"}),
+                Production<TestType>("0", {"1", "[", "0", "]", "0"}),
+        };
+        const std::unordered_set<TestType> alphabet{"0", "1", "[", "]"};
+        return LSystemInterpreter<TestType>(axiom, productions, alphabet);
+    }
+
+    Turtle<TestType> TreeTurtle() {
+        return Turtle<TestType>({
+            DrawRuleStruct<TestType>{.symbolType = "0", .draw_line_size = 1.0f, .end_this_branch = true},
+            DrawRuleStruct<TestType>{.symbolType = "1", .draw_line_size = 1.0f},
+            DrawRuleStruct<TestType>{.symbolType = "[", .turn_angle = -0.785398f, .push_fifo = true},
+            DrawRuleStruct<TestType>{.symbolType = "]", .turn_angle = 0.785398f, .pop_fifo = true},
+        }, {400.0f, 430.0f});
+    }
+
+    SegmentBuffer Interpret(const Turtle<TestType>& turtle, const std::vector<TestType>& input) {
+        SegmentBuffer segments;
+        turtle.Interpret(input, 1.0f, [&segments](const TurtleVector& start, const TurtleVector& end) {
+            segments.Add(start, end);
+        });
+        return segments;
+    }
+}
+
+
+TEST_CASE("Compiled L-system expands like the interpreter") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+
+    std::vector<TestType> expected = lsystem.getAxiom();
+    for (std::size_t generation = 0; generation < 6; generation++) {
+        std::vector<TestType> expanded;
+        compiled.Expand(generation, [&compiled, &expanded](const std::uint32_t id) {
+            expanded.push_back(compiled.getSymbol(id));
+        });
+        CHECK(expanded == expected);
+        expected = lsystem();
+    }
+
+    CHECK(! compiled.HasProduction(compiled.IdFromSymbol("[")));
+    CHECK_THROWS_AS(compiled.IdFromSymbol("x"), std::invalid_argument);
+}
+
+TEST_CASE("Streaming turtle draws the same as deriving first") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const Turtle<TestType> turtle = TreeTurtle();
+    const StreamingTurtle<TestType> streaming(CompiledLSystem<TestType>(lsystem), turtle);
+
+    std::vector<TestType> state;
+    for (std::size_t generation = 1; generation <= 8; generation++) {
+        state = lsystem();
+        CHECK(streaming.MaxBranchDepth(generation) == turtle.MaxBranchDepth(state));
+
+        const SegmentBuffer expected = Interpret(turtle, state);
+        SegmentBuffer streamed;
+        streaming.Interpret(generation, 1.0f, [&streamed](const TurtleVector& start, const TurtleVector& end) {
+            streamed.Add(start, end);
+        });
+        CHECK(expected.end_x == streamed.end_x);
+        CHECK(expected.end_y == streamed.end_y);
+    }
+}
+
+TEST_CASE("Streaming turtle rejects unbalanced generations") {
+    const std::vector<TestType> axiom = {"A"};
+    std::unordered_set<Production<TestType>> productions{
+            Production<TestType>("A", {"]", "A"}),
+    };
+    const std::unordered_set<TestType> alphabet{"A", "[", "]"};
+    const LSystemInterpreter<TestType> lsystem(axiom, productions, alphabet);
+    const StreamingTurtle<TestType> streaming(CompiledLSystem<TestType>(lsystem), TreeTurtle());
+
+    CHECK(streaming.MaxBranchDepth(0) == 0);
+    CHECK_THROWS_AS(streaming.MaxBranchDepth(3), std::invalid_argument);
+}
+
+namespace {
+    void CheckSameSegments(const SegmentBuffer& expected, const SegmentBuffer& actual) {
+        REQUIRE(expected.Size() == actual.Size());
+        for (std::size_t i = 0; i < expected.Size(); i++) {
+            REQUIRE(actual.start_x[i] == Approx(expected.start_x[i]).epsilon(1e-4).margin(1e-2));
+            REQUIRE(actual.start_y[i] == Approx(expected.start_y[i]).epsilon(1e-4).margin(1e-2));
+            REQUIRE(actual.end_x[i] == Approx(expected.end_x[i]).epsilon(1e-4).margin(1e-2));
+            REQUIRE(actual.end_y[i] == Approx(expected.end_y[i]).epsilon(1e-4).margin(1e-2));
+        }
+    }
+}
+
+TEST_CASE("Subtree instancing expands to the turtle output") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const Turtle<TestType> turtle = TreeTurtle();
+
+    std::vector<TestType> state;
+    for (std::size_t generation = 1; generation <= 10; generation++) {
+        state = lsystem();
+        const DerivationTables<TestType> tables(compiled, turtle, generation);
+
+        SegmentBuffer expanded;
+        tables.Expand([&expanded](const TurtleVector& start, const TurtleVector& end) {
+            expanded.Add(start, end);
+        });
+        CheckSameSegments(Interpret(turtle, state), expanded);
+        CHECK(tables.getSegmentCount() == expanded.Size());
+        // One node per distinct (symbol, depth), not per segment
+        CHECK(tables.getNodeCount() <= 4 * (generation + 1));
+    }
+}
+
+TEST_CASE("Subtree instancing inlines unbalanced subtrees") {
+    // A opens a branch that the production of X closes
+    const std::vector<TestType> axiom = {"X"};
+    std::unordered_set<Production<TestType>> productions{
+            Production<TestType>("X", {"F", "A", "]", "X"}),
+            Production<TestType>("A", {"[", "+", "F", "X"}),
+    };
+    const std::unordered_set<TestType> alphabet{"X", "A", "F", "+", "[", "]"};
+    LSystemInterpreter<TestType> lsystem(axiom, productions, alphabet);
+    const Turtle<TestType> turtle({
+        DrawRuleStruct<TestType>{.symbolType = "F", .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = "+", .turn_angle = 0.4f},
+        DrawRuleStruct<TestType>{.symbolType = "A", .push_fifo = true},
+        DrawRuleStruct<TestType>{.symbolType = "[", .push_fifo = true},
+        DrawRuleStruct<TestType>{.symbolType = "]", .turn_angle = -0.2f, .pop_fifo = true},
+    }, {0.0f, 0.0f});
+    const CompiledLSystem<TestType> compiled(lsystem);
+
+    std::vector<TestType> state;
+    for (std::size_t generation = 1; generation <= 6; generation++) {
+        state = lsystem();
+        const DerivationTables<TestType> tables(compiled, turtle, generation);
+        SegmentBuffer expanded;
+        tables.Expand([&expanded](const TurtleVector& start, const TurtleVector& end) {
+            expanded.Add(start, end);
+        });
+        CheckSameSegments(Interpret(turtle, state), expanded);
+    }
+}
+
+TEST_CASE("Subtree bounds match the drawn extent") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const Turtle<TestType> turtle = TreeTurtle();
+
+    std::vector<TestType> state;
+    for (std::size_t generation = 1; generation <= 8; generation++) {
+        state = lsystem();
+        const DerivationTables<TestType> tables(compiled, turtle, generation);
+        const SegmentBuffer segments = Interpret(turtle, state);
+
+        TurtleBounds expected;
+        for (std::size_t i = 0; i < segments.Size(); i++) {
+            expected.Add(segments.Start(i));
+            expected.Add(segments.End(i));
+        }
+        const TurtleBounds bounds = tables.getBounds();
+        CHECK(bounds.min.x == Approx(expected.min.x).epsilon(1e-4).margin(1e-2));
+        CHECK(bounds.min.y == Approx(expected.min.y).epsilon(1e-4).margin(1e-2));
+        CHECK(bounds.max.x == Approx(expected.max.x).epsilon(1e-4).margin(1e-2));
+        CHECK(bounds.max.y == Approx(expected.max.y).epsilon(1e-4).margin(1e-2));
+    }
+}
+
+TEST_CASE("Subtree bounds cull invisible subtrees") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const DerivationTables<TestType> tables(compiled, TreeTurtle(), 8);
+    const TurtleBounds all = tables.getBounds();
+
+    std::size_t visible_count = 0;
+    tables.ExpandVisible(all, [&visible_count](const TurtleVector&, const TurtleVector&) { visible_count++; });
+    CHECK(visible_count == tables.getSegmentCount());
+
+    // The right half of the tree, every segment that touches it has to be there
+    TurtleBounds right_half = all;
+    right_half.min.x = (all.min.x + all.max.x) / 2.0f + 1.0f;
+    std::size_t culled_count = 0;
+    tables.ExpandVisible(right_half, [&culled_count](const TurtleVector&, const TurtleVector&) { culled_count++; });
+
+    std::size_t touching_count = 0;
+    tables.Expand([&](const TurtleVector& start, const TurtleVector& end) {
+        if (std::max(start.x, end.x) >= right_half.min.x) {
+            touching_count++;
+        }
+    });
+    CHECK(culled_count >= touching_count);
+    CHECK(culled_count < tables.getSegmentCount());
+
+    std::size_t nothing_count = 0;
+    tables.ExpandVisible(TurtleBounds{}, [&nothing_count](const TurtleVector&, const TurtleVector&) { nothing_count++; });
+    CHECK(nothing_count == 0);
+}
+
+TEST_CASE("Subtree tables give the turtle state at any symbol") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const Turtle<TestType> turtle = TreeTurtle();
+
+    std::vector<TestType> state;
+    for (std::size_t generation = 1; generation <= 7; generation++) {
+        state = lsystem();
+        const DerivationTables<TestType> tables(compiled, turtle, generation);
+        REQUIRE(tables.getLength() == state.size());
+
+        turtle.Interpret(state, 1.0f, [](const TurtleVector&, const TurtleVector&) {},
+                         [&tables](const std::size_t index, const TestType&, const TurtleState& expected) {
+            const TurtleState actual = tables.StateAt(index);
+            REQUIRE(actual.position.x == Approx(expected.position.x).epsilon(1e-4).margin(1e-2));
+            REQUIRE(actual.position.y == Approx(expected.position.y).epsilon(1e-4).margin(1e-2));
+            REQUIRE(actual.angle == Approx(expected.angle).margin(1e-4));
+        });
+        CHECK_THROWS_AS(tables.StateAt(state.size()), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Level of detail replaces small subtrees by one segment") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const DerivationTables<TestType> tables(compiled, TreeTurtle(), 12);
+    const TurtleBounds all = tables.getBounds();
+
+    std::size_t full_count = 0;
+    tables.ExpandVisible(all, 0.0f, [&full_count](const TurtleVector&, const TurtleVector&) { full_count++; });
+    CHECK(full_count == tables.getSegmentCount());
+
+    // Subtrees below 1/200 of the picture, about a pixel on a small window
+    const float min_extent = std::max(all.Width(), all.Height()) / 200.0f;
+    SegmentBuffer reduced;
+    tables.ExpandVisible(all, min_extent, [&reduced](const TurtleVector& start, const TurtleVector& end) {
+        reduced.Add(start, end);
+    });
+    CHECK(reduced.Size() * 10 < tables.getSegmentCount());
+
+    // Proxies stay inside the picture
+    for (std::size_t i = 0; i < reduced.Size(); i++) {
+        CHECK(reduced.end_x[i] >= all.min.x - 1e-2f);
+        CHECK(reduced.end_x[i] <= all.max.x + 1e-2f);
+        CHECK(reduced.end_y[i] >= all.min.y - 1e-2f);
+        CHECK(reduced.end_y[i] <= all.max.y + 1e-2f);
+    }
+}
+
+TEST_CASE("Picked segments lead back to their symbol") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const Turtle<TestType> turtle = TreeTurtle();
+
+    std::vector<TestType> state;
+    for (std::size_t generation = 0; generation < 7; generation++) {
+        state = lsystem();
+    }
+    const DerivationTables<TestType> tables(compiled, turtle, 7);
+
+    SegmentBuffer segments;
+    std::vector<std::uint32_t> symbol_of_segment;
+    InterpretWithProvenance(turtle, state, 1.0f, segments, symbol_of_segment);
+    REQUIRE(symbol_of_segment.size() == segments.Size());
+
+    SegmentGrid grid;
+    grid.Build(segments);
+    for (std::size_t segment = 0; segment < segments.Size(); segment += 7) {
+        CHECK(tables.SymbolOfSegment(segment) == symbol_of_segment[segment]);
+
+        // The middle of a segment picks a segment drawn by a symbol at the same place
+        const TurtleVector middle{(segments.start_x[segment] + segments.end_x[segment]) / 2.0f,
+                                  (segments.start_y[segment] + segments.end_y[segment]) / 2.0f};
+        SegmentPick pick;
+        REQUIRE(tables.PickSegment(middle, 0.1f, pick));
+        CHECK(pick.distance < 1e-2f);
+        CHECK(tables.SymbolOfSegment(pick.segment) == pick.symbol);
+        std::uint32_t nearest = 0;
+        REQUIRE(grid.Nearest(middle, 0.1f, nearest));
+        CHECK(nearest <= segment);  // Overlapping trunks, the first one drawn wins
+    }
+
+    // The path starts at a symbol of the axiom and ends at the symbol itself
+    const std::uint64_t symbol = symbol_of_segment.back();
+    const auto path = tables.DerivationPath(symbol);
+    REQUIRE(! path.empty());
+    CHECK(compiled.getSymbol(tables.getNode(path.back()).symbol) == state[symbol]);
+    CHECK(tables.getNode(path.front()).depth == 7);
+
+    SegmentPick pick;
+    CHECK(! tables.PickSegment({-1000.0f, -1000.0f}, 1.0f, pick));
+    CHECK_THROWS_AS(tables.SymbolOfSegment(tables.getSegmentCount()), std::invalid_argument);
+}
+
+TEST_CASE("Sampled segments are segments of the generation") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const CompiledLSystem<TestType> compiled(lsystem);
+    const Turtle<TestType> turtle = TreeTurtle();
+    const DerivationTables<TestType> tables(compiled, turtle, 7);
+
+    SegmentBuffer segments;
+    tables.Expand([&segments](const TurtleVector& start, const TurtleVector& end) {
+        segments.Add(start, end);
+    });
+    for (std::size_t segment = 0; segment < segments.Size(); segment += 5) {
+        const SegmentPick pick = tables.SegmentAt(segment);
+        CHECK(pick.start.x == Approx(segments.start_x[segment]).margin(1e-3));
+        CHECK(pick.start.y == Approx(segments.start_y[segment]).margin(1e-3));
+        CHECK(pick.end.x == Approx(segments.end_x[segment]).margin(1e-3));
+        CHECK(pick.end.y == Approx(segments.end_y[segment]).margin(1e-3));
+        CHECK(pick.symbol == tables.SymbolOfSegment(segment));
+    }
+    CHECK_THROWS_AS(tables.SegmentAt(tables.getSegmentCount()), std::invalid_argument);
+
+    // Uniform over all segments: with more picks than segments, most segments show up
+    SegmentBuffer sample;
+    const auto add = [&sample](const TurtleVector& start, const TurtleVector& end) { sample.Add(start, end); };
+    tables.SampleSegments(4 * segments.Size(), 42, add);
+    REQUIRE(sample.Size() == 4 * segments.Size());
+    const auto segment_key = [](const SegmentBuffer& buffer, const std::size_t i) {
+        return std::to_string(std::lround(buffer.start_x[i] * 100.0f)) + "," + std::to_string(std::lround(buffer.start_y[i] * 100.0f)) +
+               "," + std::to_string(std::lround(buffer.end_x[i] * 100.0f)) + "," + std::to_string(std::lround(buffer.end_y[i] * 100.0f));
+    };
+    std::unordered_set<std::string> all;
+    std::unordered_set<std::string> sampled;
+    for (std::size_t i = 0; i < segments.Size(); i++) {
+        all.insert(segment_key(segments, i));
+    }
+    for (std::size_t i = 0; i < sample.Size(); i++) {
+        CHECK(all.count(segment_key(sample, i)) == 1);
+        sampled.insert(segment_key(sample, i));
+    }
+    CHECK(sampled.size() > all.size() * 9 / 10);
+
+    // Same seed, same sample
+    SegmentBuffer again;
+    tables.SampleSegments(4 * segments.Size(), 42, [&again](const TurtleVector& start, const TurtleVector& end) {
+        again.Add(start, end);
+    });
+    CHECK(again.start_x == sample.start_x);
+}
@@ -0,0 +1,460 @@
+#include "catch2/catch.hpp"
+
+#include <unordered_set>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include "lsystem/LSystemInterpreter.hpp"
+#include "lsystem/CompiledLSystem.hpp"
+#include "lsystem/DerivationTables.hpp"
+#include "lsystem/RenderBackend.hpp"
+#include "lsystem/Rasterizer.hpp"
+#include "lsystem/Density.hpp"
+#include "lsystem/SvgExport.hpp"
+#include "lsystem/SegmentFile.hpp"
+#include "../src/LSystemDrawing.hpp"
+
+
+namespace {
+    using TestType = std::string;
+
+    LSystemInterpreter<TestType> TreeLSystem() {
+        const std::vector<TestType> axiom = {"0"};
+        std::unordered_set<Production<TestType>> productions{
+                Production<TestType>("1", {"1", "1"}),
+                Production<TestType>("0", {"1", "[", "0", "]", "0"}),
+        };
+        const std::unordered_set<TestType> alphabet{"0", "1", "[", "]"};
+        return LSystemInterpreter<TestType>(axiom, productions, alphabet);
+    }
+
+    const std::vector<DrawRuleStruct<TestType>> tree_rules{
+        DrawRuleStruct<TestType>{.symbolType = "0", .draw_line_size = 35.0f, .end_this_branch = true},
+        DrawRuleStruct<TestType>{.symbolType = "1", .draw_line_size = 35.0f},
+        DrawRuleStruct<TestType>{.symbolType = "[", .turn_angle = -0.785398f, .push_fifo = true},
+        DrawRuleStruct<TestType>{.symbolType = "]", .turn_angle = 0.785398f, .pop_fifo = true},
+    };
+}
+
+
+TEST_CASE("Drawing submits its lines to the backend") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    std::vector<TestType> state;
+    for (int generation = 0; generation < 6; generation++) {
+        state = lsystem();
+    }
+    LSystemDrawing<TestType> drawing(tree_rules, 800.0f, 450.0f);
+    NullBackend unfitted;
+    drawing.Draw(unfitted, state);
+    TurtleBounds bounds;
+    for (std::size_t i = 0; i < drawing.getSegments().Size(); i++) {
+        bounds.Add(drawing.getSegments().Start(i));
+        bounds.Add(drawing.getSegments().End(i));
+    }
+    drawing.SetView(FitView(bounds, 800.0f, 450.0f, 20.0f));
+
+    RecordingBackend recording;
+    drawing.Draw(recording, state);
+    const PolylineBuffer& polylines = drawing.getPolylines();
+    REQUIRE(recording.lines.Size() == polylines.SegmentCount());
+    REQUIRE(recording.lines.Size() > 0);
+    CHECK(recording.lines.Size() < drawing.getSegments().Size());
+    CHECK(recording.thickness.front() == Approx(std::max(1.0f, 5.0f * drawing.getView().scale)));
+
+    // Screen space, the trunk starts at the root
+    const TurtleVector root = drawing.getView().ToScreen(drawing.getTurtle().getOrigin());
+    bool root_drawn = false;
+    for (std::size_t i = 0; i < recording.lines.Size(); i++) {
+        root_drawn |= recording.lines.start_x[i] == Approx(root.x) && recording.lines.start_y[i] == Approx(root.y);
+    }
+    CHECK(root_drawn);
+
+    // Cached, the same lines again
+    NullBackend null;
+    drawing.Draw(null, state);
+    CHECK(null.line_count == recording.lines.Size());
+
+    // Another input is only drawn after `Invalidate`, until then the cache stays
+    std::vector<TestType> edited{"1", "1"};
+    drawing.Invalidate();
+    drawing.Draw(null, edited);
+    CHECK(drawing.getSegments().Size() == 2);
+    edited[1] = "[";
+    drawing.Draw(null, edited);
+    CHECK(drawing.getSegments().Size() == 2);
+    drawing.Invalidate();
+    drawing.Draw(null, edited);
+    CHECK(drawing.getSegments().Size() == 1);
+}
+
+TEST_CASE("Drawing from subtree tables only submits what is on screen") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    LSystemDrawing<TestType> drawing(tree_rules, 800.0f, 450.0f);
+    const DerivationTables<TestType> tables(CompiledLSystem<TestType>(lsystem), drawing.getTurtle(), 12, 0.05f);
+    drawing.SetDetailThreshold(0.0f);
+
+    drawing.SetView(FitView(tables.getBounds(), 800.0f, 450.0f, 20.0f));
+    NullBackend fitted;
+    drawing.DrawVisible(fitted, tables);
+    CHECK(drawing.getSegments().Size() == tables.getSegmentCount());
+
+    // Zoomed in on the corner of the screen
+    drawing.SetView(drawing.getView().ZoomedAt({0.0f, 0.0f}, 8.0f));
+    NullBackend zoomed;
+    drawing.DrawVisible(zoomed, tables);
+    CHECK(drawing.getSegments().Size() < tables.getSegmentCount() / 2);
+    CHECK(zoomed.line_count <= fitted.line_count);
+
+    NullBackend sampled;
+    drawing.DrawSampled(sampled, tables, 1000);
+    CHECK(sampled.line_count == 1000);
+}
+
+TEST_CASE("Progressive drawing spreads the lines over several calls") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    LSystemDrawing<TestType> drawing(tree_rules, 800.0f, 450.0f);
+    const DerivationTables<TestType> tables(CompiledLSystem<TestType>(lsystem), drawing.getTurtle(), 12, 0.05f);
+    drawing.SetDetailThreshold(0.0f);
+    drawing.SetView(FitView(tables.getBounds(), 800.0f, 450.0f, 20.0f));
+
+    NullBackend complete;
+    drawing.DrawVisible(complete, tables);
+
+    // No budget, one chunk per call
+    RecordingBackend recording;
+    DrawProgress progress = drawing.DrawVisibleProgressive(recording, tables, 0.0);
+    CHECK(progress.restarted);
+    CHECK(progress.total == complete.line_count);
+    CHECK(progress.drawn < progress.total);
+    std::size_t calls = 1;
+    while (!progress.Done()) {
+        progress = drawing.DrawVisibleProgressive(recording, tables, 0.0);
+        CHECK_FALSE(progress.restarted);
+        calls++;
+    }
+    CHECK(calls > 1);
+    REQUIRE(recording.lines.Size() == complete.line_count);
+
+    // Coarse to fine, the longest lines come first
+    const auto length = [&recording](const std::size_t i) {
+        return std::hypot(recording.lines.end_x[i] - recording.lines.start_x[i],
+                          recording.lines.end_y[i] - recording.lines.start_y[i]);
+    };
+    CHECK(length(0) >= length(recording.lines.Size() - 1));
+    CHECK(length(0) >= length(recording.lines.Size() / 2));
+    // Ordered by length classes a factor sqrt(2) apart, never a longer class after a shorter one
+    float shortest = length(0);
+    for (std::size_t i = 1; i < recording.lines.Size(); i++) {
+        REQUIRE(length(i) <= shortest * 1.4143f + 1e-3f);
+        shortest = std::min(shortest, length(i));
+    }
+
+    // A new view starts over
+    drawing.SetView(drawing.getView().Panned({10.0f, 0.0f}));
+    progress = drawing.DrawVisibleProgressive(recording, tables, 1.0);
+    CHECK(progress.restarted);
+    CHECK(progress.Done());
+    CHECK(recording.lines.Size() == progress.total);
+}
+
+TEST_CASE("CPU rasterizer draws thick anti-aliased lines") {
+    SegmentBuffer lines;
+    lines.Add({10.0f, 20.0f}, {190.0f, 20.0f});
+    lines.Add({100.0f, 5.0f}, {100.0f, 95.0f});
+    lines.Add({-50.0f, -50.0f}, {-10.0f, -10.0f});  // Off screen
+    const std::vector<float> thickness{5.0f, 1.0f, 3.0f};
+    const RasterColor background{245, 245, 245, 255};
+    const RasterColor gray{80, 80, 80, 255};
+
+    Framebuffer single(200, 100, background);
+    RasterizeLines(lines, thickness, gray, single, 1, 16);
+    // On the thick line, at its anti-aliased edge, and away from everything
+    const auto red = [](const Framebuffer& framebuffer, const std::size_t x, const std::size_t y) {
+        return static_cast<int>(framebuffer.Pixel(x, y)[0]);
+    };
+    CHECK(red(single, 50, 20) == 80);
+    CHECK(red(single, 50, 21) == 80);
+    CHECK(red(single, 50, 22) > 80);
+    CHECK(red(single, 50, 22) < 245);
+    CHECK(red(single, 50, 23) == 245);
+    CHECK(red(single, 50, 60) == 245);
+    CHECK(red(single, 100, 60) < 245);
+
+    // Tiles are independent, the image doesn't depend on the threads
+    Framebuffer parallel(200, 100, background);
+    RasterizeLines(lines, thickness, gray, parallel, 4, 16);
+    CHECK(parallel.rgba == single.rgba);
+
+    const std::string path = "rasterizer_test.png";
+    WritePNG(path, parallel);
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> png((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::remove(path.c_str());
+    REQUIRE(png.size() > 200 * 100 * 4);
+    CHECK(std::string(png.begin() + 1, png.begin() + 4) == "PNG");
+    CHECK(std::string(png.end() - 8, png.end() - 4) == "IEND");
+
+    CHECK_THROWS_AS(RasterizeLines(lines, {1.0f}, gray, single), std::invalid_argument);
+}
+
+TEST_CASE("Tiled TIFF rendering matches the framebuffer") {
+    SegmentBuffer lines;
+    std::vector<float> thickness;
+    for (int i = 0; i < 40; i++) {
+        lines.Add({static_cast<float>(i * 7), 0.0f}, {static_cast<float>(300 - i * 5), 150.0f});
+        thickness.push_back(1.0f + static_cast<float>(i % 4));
+    }
+    const RasterColor background{255, 255, 255, 255};
+    const RasterColor black{0, 0, 0, 255};
+    Framebuffer expected(300, 150, background);
+    RasterizeLines(lines, thickness, black, expected);
+
+    const std::string path = "tiled_render_test.tif";
+    RenderTiledTIFF(path, lines, thickness, black, background, 300, 150, 64, 4);
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> tiff((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::remove(path.c_str());
+
+    const auto read = [&tiff](const std::size_t offset, const std::size_t size) {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < size; i++) {
+            value |= static_cast<std::uint64_t>(tiff[offset + i]) << (8 * i);
+        }
+        return value;
+    };
+    REQUIRE(tiff.size() > 16);
+    REQUIRE(read(0, 2) == 0x4949);
+    REQUIRE(read(2, 2) == 42);
+
+    // Find the tile offsets in the directory, 5 x 3 tiles of 64 pixels
+    const std::size_t directory = read(4, 4);
+    std::vector<std::size_t> offsets;
+    for (std::size_t entry = 0; entry < read(directory, 2); entry++) {
+        const std::size_t at = directory + 2 + 12 * entry;
+        if (read(at, 2) == 324) {
+            for (std::size_t tile = 0; tile < read(at + 4, 4); tile++) {
+                offsets.push_back(read(read(at + 8, 4) + 4 * tile, 4));
+            }
+        }
+    }
+    REQUIRE(offsets.size() == 15);
+    CHECK(tiff.size() == offsets.back() + 64 * 64 * 4);
+
+    for (std::size_t tile = 0; tile < offsets.size(); tile++) {
+        for (std::size_t y = 0; y < 64 && (tile / 5) * 64 + y < 150; y++) {
+            for (std::size_t x = 0; x < 64 && (tile % 5) * 64 + x < 300; x++) {
+                const std::uint8_t* pixel = expected.Pixel((tile % 5) * 64 + x, (tile / 5) * 64 + y);
+                REQUIRE(tiff[offsets[tile] + 4 * (y * 64 + x)] == pixel[0]);
+            }
+        }
+    }
+
+    CHECK_THROWS_AS(RenderTiledTIFF(path, lines, thickness, black, background, 300, 150, 50), std::invalid_argument);
+}
+
+TEST_CASE("Density accumulates line length per pixel") {
+    DensityBuffer single(100, 50);
+    single.AddLine({10.0f, 10.5f}, {30.0f, 10.5f});
+    CHECK(single.density[10 * 100 + 20] == Approx(1.0f));
+    CHECK(single.density[11 * 100 + 20] == 0.0f);
+    // Only the part inside the buffer counts
+    single.AddLine({-100.0f, 20.5f}, {50.0f, 20.5f});
+    float total = 0.0f;
+    for (const auto value: single.density) {
+        total += value;
+    }
+    CHECK(total == Approx(70.0f));
+
+    // Threads each fill their own buffer, the sum is the same
+    SegmentBuffer lines;
+    for (int i = 0; i < 100000; i++) {
+        const auto angle = static_cast<float>(i) * 0.001f;
+        lines.Add({50.0f, 25.0f}, {50.0f + 40.0f * std::cos(angle), 25.0f + 20.0f * std::sin(angle)});
+    }
+    DensityBuffer sequential(100, 50);
+    AccumulateDensity(lines, sequential, 1);
+    DensityBuffer parallel(100, 50);
+    AccumulateDensity(lines, parallel, 4);
+    for (std::size_t i = 0; i < sequential.density.size(); i++) {
+        REQUIRE(parallel.density[i] == Approx(sequential.density[i]).epsilon(1e-3));
+    }
+
+    Framebuffer image;
+    ToneMapDensity(parallel, {255, 255, 255, 255}, {0, 0, 0, 255}, 1.0f, image);
+    REQUIRE(image.width == 100);
+    CHECK(static_cast<int>(image.Pixel(50, 25)[0]) < 50);
+    CHECK(static_cast<int>(image.Pixel(0, 0)[0]) == 255);
+}
+
+TEST_CASE("Visible parts of the subtree tables split the density work") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    LSystemDrawing<TestType> drawing(tree_rules, 800.0f, 450.0f);
+    const DerivationTables<TestType> tables(CompiledLSystem<TestType>(lsystem), drawing.getTurtle(), 12, 0.05f);
+    const TurtleView view = FitView(tables.getBounds(), 800.0f, 450.0f, 20.0f).ZoomedAt({400.0f, 225.0f}, 2.0f);
+    const TurtleBounds visible = view.Visible(800.0f, 450.0f);
+
+    SegmentBuffer whole;
+    tables.ExpandVisible(visible, [&whole](const TurtleVector& start, const TurtleVector& end) { whole.Add(start, end); });
+    const std::vector<PlacedSubtree> parts = tables.SplitVisible(visible, 0.0f, 16);
+    CHECK(parts.size() >= 16);
+    SegmentBuffer split;
+    for (const auto& part: parts) {
+        tables.ExpandVisible(part, visible, 0.0f, [&split](const TurtleVector& start, const TurtleVector& end) {
+            split.Add(start, end);
+        });
+    }
+    REQUIRE(split.Size() == whole.Size());
+    CHECK(split.start_x == whole.start_x);
+    CHECK(split.end_y == whole.end_y);
+
+    DensityBuffer sequential(800, 450);
+    tables.ExpandVisible(visible, DensitySink(sequential, view));
+    DensityBuffer parallel(800, 450);
+    AccumulateDensityParts(parts.size(), parallel, 4, [&](const std::size_t part, DensityBuffer& target) {
+        tables.ExpandVisible(parts[part], visible, 0.0f, DensitySink(target, view));
+    });
+    for (std::size_t i = 0; i < sequential.density.size(); i++) {
+        REQUIRE(parallel.density[i] == Approx(sequential.density[i]).epsilon(1e-3).margin(1e-4));
+    }
+}
+
+TEST_CASE("SVG export stitches and quantizes the segments") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    const LSystemDrawing<TestType> drawing(tree_rules, 800.0f, 450.0f);
+    const DerivationTables<TestType> tables(CompiledLSystem<TestType>(lsystem), drawing.getTurtle(), 6, 0.1f);
+    const std::string path = "test_export.svg";
+
+    double length = 0.0;
+    SvgWriter writer(path, tables.getBounds(), 0.01f);
+    tables.Expand([&](const TurtleVector& start, const TurtleVector& end) {
+        length += std::hypot(end.x - start.x, end.y - start.y);
+        writer(start, end);
+    });
+    const SvgStats stats = writer.Finish();
+    CHECK(stats.segments == tables.getSegmentCount());
+    CHECK(stats.pieces < stats.segments);  // 1 -> 1 1 chains become one piece
+    CHECK(stats.polylines > 1);
+
+    std::ifstream file(path, std::ios::binary);
+    const std::string svg((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::remove(path.c_str());
+    CHECK(svg.size() == stats.bytes);
+    CHECK(svg.rfind("</svg>\n") == svg.size() - 7);
+
+    // Walk the path data back, the pieces add up to the same length
+    std::uint64_t polylines = 0;
+    std::uint64_t pieces = 0;
+    double exported = 0.0;
+    for (std::size_t d = svg.find(" d=\""); d != std::string::npos; d = svg.find(" d=\"", d + 1)) {
+        std::istringstream data(svg.substr(d + 4, svg.find('"', d + 4) - d - 4));
+        char command = 0;
+        while (data >> command) {
+            REQUIRE(command == 'M');
+            long long x = 0;
+            long long y = 0;
+            data >> x >> y >> command;
+            REQUIRE(command == 'l');
+            polylines++;
+            while (data >> std::ws && data.peek() != 'M' && data.peek() != EOF) {
+                long long step_x = 0;
+                long long step_y = 0;
+                data >> step_x >> step_y;
+                exported += std::hypot(static_cast<double>(step_x), static_cast<double>(step_y)) * 0.01;
+                pieces++;
+            }
+        }
+    }
+    CHECK(polylines == stats.polylines);
+    CHECK(pieces == stats.pieces);
+    CHECK(exported == Approx(length).epsilon(1e-3));
+}
+
+TEST_CASE("Segment files map back the segments that were written") {
+    LSystemInterpreter<TestType> lsystem = TreeLSystem();
+    std::vector<TestType> state;
+    for (int generation = 0; generation < 7; generation++) {
+        state = lsystem();
+    }
+    const LSystemDrawing<TestType> drawing(tree_rules, 800.0f, 450.0f);
+    SegmentBuffer segments;
+    std::vector<std::uint32_t> symbol_of_segment;
+    InterpretWithProvenance(drawing.getTurtle(), state, 1.0f, segments, symbol_of_segment);
+    const std::string path = "test_segments.lseg";
+
+    SECTION("Floats with provenance") {
+        WriteSegmentFile(path, segments, SegmentEncoding::Float32, &symbol_of_segment);
+        const SegmentFile file(path);
+        REQUIRE(file.Size() == segments.Size());
+        REQUIRE(file.HasProvenance());
+        REQUIRE(file.FloatArray(SegmentArray::EndY) != nullptr);
+        CHECK(file.QuantizedArray(SegmentArray::EndY) == nullptr);
+        CHECK(std::equal(segments.end_y.begin(), segments.end_y.end(), file.FloatArray(SegmentArray::EndY)));
+        for (std::size_t i = 0; i < segments.Size(); i++) {
+            CHECK(file.Start(i).x == segments.start_x[i]);
+            CHECK(file.End(i).y == segments.end_y[i]);
+            CHECK(file.Provenance()[i] == symbol_of_segment[i]);
+        }
+    }
+
+    SECTION("Quantized, streamed from the subtree tables") {
+        const DerivationTables<TestType> tables(CompiledLSystem<TestType>(lsystem), drawing.getTurtle(), 7);
+        SegmentFileWriter writer(path, tables.getSegmentCount(), tables.getBounds(), SegmentEncoding::Quantized16);
+        tables.Expand(writer);
+        writer.Finish();
+
+        SegmentFile file(path);
+        const SegmentFile moved = std::move(file);
+        REQUIRE(moved.Size() == segments.Size());
+        CHECK_FALSE(moved.HasProvenance());
+        CHECK(moved.FloatArray(SegmentArray::StartX) == nullptr);
+        const float step_x = moved.getBounds().Width() / 65535.0f;
+        const float step_y = moved.getBounds().Height() / 65535.0f;
+        std::size_t i = 0;
+        moved.ForEach([&](const TurtleVector& start, const TurtleVector& end) {
+            CHECK(start.x == Approx(segments.start_x[i]).margin(step_x));
+            CHECK(start.y == Approx(segments.start_y[i]).margin(step_y));
+            CHECK(end.x == Approx(segments.end_x[i]).margin(step_x));
+            CHECK(end.y == Approx(segments.end_y[i]).margin(step_y));
+            i++;
+        });
+        CHECK(i == segments.Size());
+    }
+
+    SECTION("Broken files") {
+        SegmentFileWriter writer(path, 2, {}, SegmentEncoding::Float32, true);
+        writer({0.0f, 0.0f}, {1.0f, 1.0f});
+        CHECK_THROWS_AS(writer.Add({0.0f, 0.0f}, {1.0f, 1.0f}, std::uint64_t{1} << 32), std::overflow_error);
+        CHECK_THROWS_AS(writer.Finish(), std::invalid_argument);
+
+        // More segments than the header says, the file stays as it was
+        SegmentFileWriter full(path, 1, {}, SegmentEncoding::Float32, true);
+        full.Add({0.0f, 0.0f}, {1.0f, 1.0f}, 7);
+        CHECK_THROWS_AS(full.Add({2.0f, 2.0f}, {3.0f, 3.0f}, 8), std::overflow_error);
+        CHECK_THROWS_AS(full({2.0f, 2.0f}, {3.0f, 3.0f}), std::overflow_error);
+        full.Finish();
+        const SegmentFile one(path);
+        REQUIRE(one.Size() == 1);
+        CHECK(one.End(0).x == 1.0f);
+        CHECK(one.Provenance()[0] == 7);
+
+        std::ofstream(path, std::ios::binary) << "not a segment file, but long enough to have a header............";
+        CHECK_THROWS_AS(SegmentFile(path), std::runtime_error);
+        CHECK_THROWS_AS(SegmentFile("missing.lseg"), std::runtime_error);
+    }
+
+    SECTION("Corrupt array offset") {
+        WriteSegmentFile(path, segments);
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        const std::uint64_t data_offset = ~std::uint64_t{0} - 63;  // Wraps around when the arrays are added
+        file.seekp(40);
+        file.write(reinterpret_cast<const char*>(&data_offset), sizeof(data_offset));
+        file.close();
+        CHECK_THROWS_AS(SegmentFile(path), std::runtime_error);
+    }
+    std::remove(path.c_str());
+}
@@ -0,0 +1,219 @@
+#include "catch2/catch.hpp"
+
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include "lsystem/LSystemInterpreter.hpp"
+#include "lsystem/Turtle.hpp"
+#include "lsystem/SegmentBuffer.hpp"
+#include "lsystem/ParallelTurtle.hpp"
+#include "lsystem/SegmentGrid.hpp"
+
+
+namespace {
+    // Dragon curve, no branches and lots of segments
+    std::vector<char> DragonCurve(const std::size_t generation) {
+        const std::vector<char> axiom = {'F', 'X'};
+        std::unordered_set<Production<char>> productions{
+                Production<char>('X', {'X', '+', 'Y', 'F', '+'}),
+                Production<char>('Y', {'-', 'F', 'X', '-', 'Y'}),
+        };
+        const std::unordered_set<char> alphabet{'F', 'X', 'Y', '+', '-'};
+        LSystemInterpreter<char> lsystem(axiom, productions, alphabet);
+        std::vector<char> state = axiom;
+        for (std::size_t i = 0; i < generation; i++) {
+            state = lsystem();
+        }
+        return state;
+    }
+
+    void CheckSameSegments(const SegmentBuffer& expected, const SegmentBuffer& actual) {
+        REQUIRE(expected.Size() == actual.Size());
+        for (std::size_t i = 0; i < expected.Size(); i++) {
+            REQUIRE(actual.start_x[i] == Approx(expected.start_x[i]).epsilon(1e-3).margin(1e-2));
+            REQUIRE(actual.start_y[i] == Approx(expected.start_y[i]).epsilon(1e-3).margin(1e-2));
+            REQUIRE(actual.end_x[i] == Approx(expected.end_x[i]).epsilon(1e-3).margin(1e-2));
+            REQUIRE(actual.end_y[i] == Approx(expected.end_y[i]).epsilon(1e-3).margin(1e-2));
+        }
+    }
+
+    SegmentBuffer Sequential(const Turtle<char>& turtle, const std::vector<char>& input) {
+        SegmentBuffer segments;
+        turtle.Interpret(input, 1.0f, [&segments](const TurtleVector& start, const TurtleVector& end) {
+            segments.Add(start, end);
+        });
+        return segments;
+    }
+}
+
+
+TEST_CASE("Parallel turtle matches the sequential turtle") {
+    const std::vector<char> input = DragonCurve(16);
+    REQUIRE(input.size() > 4 * parallel_turtle_min_chunk);
+
+    SECTION("Quantized turns") {
+        const Turtle<char> turtle({
+            DrawRuleStruct<char>{.symbolType = 'F', .draw_line_size = 1.0f},
+            DrawRuleStruct<char>{.symbolType = '+', .turn_angle = 3.14159265f / 2},
+            DrawRuleStruct<char>{.symbolType = '-', .turn_angle = -3.14159265f / 2},
+        }, {100.0f, 100.0f});
+        REQUIRE(turtle.IsQuantized());
+
+        SegmentBuffer parallel;
+        InterpretParallel(turtle, input, 1.0f, parallel, 4);
+        CheckSameSegments(Sequential(turtle, input), parallel);
+    }
+
+    SECTION("Free turns") {
+        const Turtle<char> turtle({
+            DrawRuleStruct<char>{.symbolType = 'F', .draw_line_size = 1.0f},
+            DrawRuleStruct<char>{.symbolType = '+', .turn_angle = 1.5f},
+            DrawRuleStruct<char>{.symbolType = '-', .turn_angle = -1.5f},
+        }, {0.0f, 0.0f});
+        REQUIRE(! turtle.IsQuantized());
+
+        SegmentBuffer parallel;
+        InterpretParallel(turtle, input, 1.0f, parallel, 3);
+        CheckSameSegments(Sequential(turtle, input), parallel);
+    }
+}
+
+TEST_CASE("Turtle transforms compose like the turtle") {
+    const Turtle<char> turtle({
+        DrawRuleStruct<char>{.symbolType = 'F', .draw_line_size = 2.0f},
+        DrawRuleStruct<char>{.symbolType = '+', .turn_angle = 0.3f},
+    }, {0.0f, 0.0f});
+    const auto forward = turtle.TransformFromRule(turtle.getCompiledRule(0), 1.0f);
+    const auto turn = turtle.TransformFromRule(turtle.getCompiledRule(1), 1.0f);
+    const TurtleTransform total = forward.Then(turn).Then(forward).Then(turn).Then(forward);
+
+    const SegmentBuffer segments = Sequential(turtle, {'F', '+', 'F', '+', 'F'});
+    const TurtleState moved = total.ApplyTo({{1.0f, 1.0f}, 0.0f});
+    CHECK(moved.position.x == Approx(1.0f + segments.end_x[2]));
+    CHECK(moved.position.y == Approx(1.0f + segments.end_y[2]));
+    CHECK(moved.angle == Approx(0.6f));
+}
+
+TEST_CASE("Branch parallel turtle matches the sequential turtle") {
+    // The tree from the visualiser
+    const std::vector<char> axiom = {'0'};
+    std::unordered_set<Production<char>> productions{
+            Production<char>('1', {'1', '1'}),
+            Production<char>('0', {'1', '[', '0', ']', '0'}),
+    };
+    const std::unordered_set<char> alphabet{'0', '1', '[', ']'};
+    LSystemInterpreter<char> lsystem(axiom, productions, alphabet);
+    std::vector<char> input;
+    for (int i = 0; i < 12; i++) {
+        input = lsystem();
+    }
+
+    const Turtle<char> turtle({
+        DrawRuleStruct<char>{.symbolType = '0', .draw_line_size = 1.0f, .end_this_branch = true},
+        DrawRuleStruct<char>{.symbolType = '1', .draw_line_size = 1.0f},
+        DrawRuleStruct<char>{.symbolType = '[', .draw_line_size = 0.5f, .turn_angle = -0.7f, .push_fifo = true},
+        DrawRuleStruct<char>{.symbolType = ']', .turn_angle = 0.7f, .pop_fifo = true},
+    }, {0.0f, 0.0f});
+
+    const SegmentBuffer expected = Sequential(turtle, input);
+
+    SegmentBuffer branch_parallel;
+    InterpretBranchParallel(turtle, input, 1.0f, branch_parallel, 4, 64);
+    REQUIRE(expected.Size() == branch_parallel.Size());
+    CHECK(expected.start_x == branch_parallel.start_x);
+    CHECK(expected.start_y == branch_parallel.start_y);
+    CHECK(expected.end_x == branch_parallel.end_x);
+    CHECK(expected.end_y == branch_parallel.end_y);
+
+    // Through the scan, which hands branches over
+    SegmentBuffer parallel;
+    InterpretParallel(turtle, input, 1.0f, parallel, 4);
+    CHECK(expected.end_x == parallel.end_x);
+}
+
+TEST_CASE("Branch parallel turtle handles symbols that push and pop") {
+    // 'X' pushes and pops in the same step, like `Apply` that leaves the stack as it was
+    const Turtle<char> turtle({
+        DrawRuleStruct<char>{.symbolType = 'F', .draw_line_size = 1.0f},
+        DrawRuleStruct<char>{.symbolType = 'X', .draw_line_size = 0.5f, .turn_angle = 0.4f,
+                             .push_fifo = true, .pop_fifo = true},
+        DrawRuleStruct<char>{.symbolType = '[', .turn_angle = -0.7f, .push_fifo = true},
+        DrawRuleStruct<char>{.symbolType = ']', .turn_angle = 0.7f, .pop_fifo = true},
+    }, {0.0f, 0.0f});
+
+    SECTION("On its own") {
+        const std::vector<char> input = {'X', 'F', 'X'};
+        SegmentBuffer branch_parallel;
+        InterpretBranchParallel(turtle, input, 1.0f, branch_parallel, 2, 1);
+        CHECK(Sequential(turtle, input).end_x == branch_parallel.end_x);
+    }
+
+    SECTION("Inside branches") {
+        // Nested branches of every size, with 'X' at the deepest point of each
+        std::vector<char> input;
+        for (int i = 0; i < 200; i++) {
+            for (int depth = 0; depth < i % 7; depth++) {
+                input.push_back('[');
+                input.push_back('F');
+            }
+            input.push_back('X');
+            for (int depth = 0; depth < i % 7; depth++) {
+                input.push_back('F');
+                input.push_back(']');
+            }
+            input.push_back('F');
+        }
+        REQUIRE(turtle.MaxBranchDepth(input) == 7);
+
+        const SegmentBuffer expected = Sequential(turtle, input);
+        SegmentBuffer branch_parallel;
+        InterpretBranchParallel(turtle, input, 1.0f, branch_parallel, 4, 4);
+        REQUIRE(expected.Size() == branch_parallel.Size());
+        CHECK(expected.start_x == branch_parallel.start_x);
+        CHECK(expected.start_y == branch_parallel.start_y);
+        CHECK(expected.end_x == branch_parallel.end_x);
+        CHECK(expected.end_y == branch_parallel.end_y);
+    }
+}
+
+TEST_CASE("Segment grid finds the same segments as a full scan") {
+    // Short segments everywhere plus a few long ones that cross many cells
+    SegmentBuffer segments;
+    std::uint32_t seed = 12345;
+    const auto random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+    };
+    for (int i = 0; i < 50000; i++) {
+        const TurtleVector start{random() * 1000.0f, random() * 500.0f};
+        segments.Add(start, {start.x + random() * 4.0f - 2.0f, start.y + random() * 4.0f - 2.0f});
+    }
+    segments.Add({0.0f, 0.0f}, {1000.0f, 500.0f});
+    segments.Add({500.0f, 0.0f}, {500.0f, 500.0f});
+
+    for (const unsigned threads: {1u, 4u}) {
+        SegmentGrid grid;
+        grid.Build(segments, threads);
+        CHECK(grid.getColumns() > 1);
+
+        for (int query = 0; query < 20; query++) {
+            TurtleBounds region;
+            region.Add(TurtleVector{random() * 1100.0f - 50.0f, random() * 600.0f - 50.0f});
+            region.Add(TurtleVector{random() * 1100.0f - 50.0f, random() * 600.0f - 50.0f});
+
+            std::vector<std::uint32_t> expected;
+            for (std::size_t i = 0; i < segments.Size(); i++) {
+                TurtleBounds box;
+                box.Add(segments.Start(i));
+                box.Add(segments.End(i));
+                if (box.Intersects(region)) {
+                    expected.push_back(static_cast<std::uint32_t>(i));
+                }
+            }
+            std::vector<std::uint32_t> found;
+            grid.Query(region, found);
+            std::sort(found.begin(), found.end());
+            REQUIRE(found == expected);
+        }
+    }
+}
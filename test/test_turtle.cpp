@@ -0,0 +1,356 @@
+#include "catch2/catch.hpp"
+
+#include <unordered_set>
+#include <vector>
+#include <fstream>
+#include "lsystem/LSystemInterpreter.hpp"
+#include "lsystem/Turtle.hpp"
+#include "lsystem/GridEnvironment.hpp"
+#include "lsystem/OpenLSystem.hpp"
+#include "lsystem/Turtle3D.hpp"
+#include "lsystem/TurtleBounds.hpp"
+#include "lsystem/Polyline.hpp"
+
+
+TEST_CASE("Turtle draws lines and branches") {
+    using TestType = std::string;
+
+    const std::vector<DrawRuleStruct<TestType>> draw_rules{
+        DrawRuleStruct<TestType>{.symbolType = "F", .draw_line_size = 10.0f},
+        DrawRuleStruct<TestType>{.symbolType = "[", .push_fifo = true},
+        DrawRuleStruct<TestType>{.symbolType = "]", .pop_fifo = true},
+    };
+    const Turtle<TestType> turtle(draw_rules, {0.0f, 0.0f});
+
+    std::vector<TurtleVector> ends;
+    turtle.Interpret({"F", "[", "F", "]", "F", "x"}, 1.0f, [&ends](const TurtleVector&, const TurtleVector& end) {
+        ends.push_back(end);
+    });
+
+    REQUIRE(ends.size() == 3);
+    CHECK(ends[0].y == Approx(-10.0f));
+    CHECK(ends[1].y == Approx(-20.0f));
+    CHECK(ends[2].y == Approx(-20.0f));  // Restored after the branch
+    CHECK(turtle.DrawruleFromSymbol("x") == nullptr);
+}
+
+TEST_CASE("Branch depth and malformed input") {
+    using TestType = char;
+
+    const Turtle<TestType> turtle({
+        DrawRuleStruct<TestType>{.symbolType = 'F', .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = '[', .push_fifo = true},
+        DrawRuleStruct<TestType>{.symbolType = ']', .pop_fifo = true},
+    }, {0.0f, 0.0f});
+
+    CHECK(turtle.MaxBranchDepth({'F', 'F'}) == 0);
+    CHECK(turtle.MaxBranchDepth({'[', 'F', '[', '[', ']', ']', ']', '[', ']'}) == 3);
+    CHECK(turtle.MaxBranchDepth({'[', '[', 'F'}) == 2);
+
+    const std::vector<TestType> malformed{'F', '[', ']', ']', 'F'};
+    CHECK_THROWS_AS(turtle.MaxBranchDepth(malformed), std::invalid_argument);
+    std::size_t drawn = 0;
+    CHECK_THROWS_AS(turtle.Interpret(malformed, 1.0f, [&drawn](const TurtleVector&, const TurtleVector&) { drawn++; }),
+                    std::invalid_argument);
+    // Rejected before anything was drawn
+    CHECK(drawn == 0);
+}
+
+TEST_CASE("Turtle dispatch table") {
+    using TestType = std::string;
+
+    const std::vector<DrawRuleStruct<TestType>> draw_rules{
+        DrawRuleStruct<TestType>{.symbolType = "F", .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = "F", .draw_line_size = 2.0f},
+        DrawRuleStruct<TestType>{.symbolType = "long", .draw_line_size = 3.0f},
+    };
+    const Turtle<TestType> turtle(draw_rules, {0.0f, 0.0f});
+
+    // The first rule for a symbol wins, like a linear search would
+    CHECK(turtle.RuleIndexFromSymbol("F") == 0);
+    CHECK(turtle.RuleIndexFromSymbol("long") == 2);
+    CHECK(turtle.RuleIndexFromSymbol("G") == Turtle<TestType>::no_rule);
+    CHECK(turtle.RuleIndexFromSymbol("longer") == Turtle<TestType>::no_rule);
+    CHECK(turtle.DrawruleFromSymbol("long")->draw_line_size == 3.0f);
+
+    const Turtle<char> empty_turtle;
+    CHECK(empty_turtle.RuleIndexFromSymbol('F') == Turtle<char>::no_rule);
+}
+
+TEST_CASE("Quantized turns") {
+    using TestType = char;
+    const float pi = 3.14159265f;
+
+    const std::vector<DrawRuleStruct<TestType>> quarter_rules{
+        DrawRuleStruct<TestType>{.symbolType = 'F', .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = '+', .turn_angle = pi / 4},
+        DrawRuleStruct<TestType>{.symbolType = '-', .turn_angle = -pi / 2},
+    };
+    const Turtle<TestType> quantized_turtle(quarter_rules, {0.0f, 0.0f});
+    CHECK(quantized_turtle.IsQuantized());
+    CHECK(quantized_turtle.getDirectionCount() == 8);
+
+    const std::vector<DrawRuleStruct<TestType>> odd_rules{
+        DrawRuleStruct<TestType>{.symbolType = 'F', .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = '+', .turn_angle = 0.123f},
+    };
+    CHECK(! Turtle<TestType>(odd_rules, {0.0f, 0.0f}).IsQuantized());
+
+    // Many turns still end up exactly where they started
+    std::vector<TestType> input;
+    for (int i = 0; i < 8000; i++) {
+        input.push_back('+');
+    }
+    input.push_back('F');
+    TurtleVector end_point;
+    quantized_turtle.Interpret(input, 1.0f, [&end_point](const TurtleVector&, const TurtleVector& end) {
+        end_point = end;
+    });
+    CHECK(end_point.x == 0.0f);
+    CHECK(end_point.y == -1.0f);
+
+    // Same picture as turning with sin/cos
+    const std::vector<TestType> curve{'F', '+', 'F', '-', 'F', '+', '+', 'F', '-', '-', 'F'};
+    std::vector<TurtleVector> quantized_ends;
+    quantized_turtle.Interpret(curve, 1.0f, [&quantized_ends](const TurtleVector&, const TurtleVector& end) {
+        quantized_ends.push_back(end);
+    });
+    TurtleState state{};
+    std::size_t segment = 0;
+    for (const auto symbol: curve) {
+        const auto* rule = quantized_turtle.DrawruleFromSymbol(symbol);
+        state.angle += rule->turn_angle;
+        if (rule->draw_line_size != 0.0f) {
+            state.position = {state.position.x + sinf(state.angle), state.position.y - cosf(state.angle)};
+            CHECK(quantized_ends[segment].x == Approx(state.position.x).margin(1e-5));
+            CHECK(quantized_ends[segment].y == Approx(state.position.y).margin(1e-5));
+            segment++;
+        }
+    }
+}
+
+TEST_CASE("Grid environment queries") {
+    GridEnvironment environment({0.0f, 0.0f}, 1.0f, 10, 10, 1.0f);
+    environment.AddObstacle({0.0f, 0.0f}, {10.0f, 2.0f});
+
+    // Looking up into the obstacle
+    CHECK(environment.Query({{5.5f, 2.5f}, 0.0f}) > 0.0f);
+    // Looking down into free space
+    CHECK(environment.Query({{5.5f, 3.5f}, 3.14159f}) == 0.0f);
+    // Looking outside the world
+    CHECK(environment.Query({{5.5f, 9.5f}, 3.14159f}) > 0.0f);
+
+    environment.AddSegment({7.5f, 9.0f}, {7.5f, 5.0f});
+    CHECK(environment.Query({{7.5f, 8.0f}, 0.0f}) == 1.0f);
+    environment.ClearSegments();
+    CHECK(environment.Query({{7.5f, 8.0f}, 0.0f}) == 0.0f);
+}
+
+TEST_CASE("Open L-system stops growing at an obstacle") {
+    using TestType = std::string;
+
+    // "A" grows a line and asks the environment if it can continue,
+    // a blocked query turns into "X" which does nothing.
+    const std::vector<TestType> axiom = {"A"};
+    std::unordered_set<Production<TestType>> productions{
+            Production<TestType>("A", {"F", "?E"}),
+            Production<TestType>("?E", {"F", "?E"}),
+    };
+    const std::unordered_set<TestType> alphabet{"A", "F", "?E", "X"};
+    const LSystemInterpreter<TestType> lsystem(axiom, productions, alphabet);
+
+    const std::vector<DrawRuleStruct<TestType>> draw_rules{
+        DrawRuleStruct<TestType>{.symbolType = "F", .draw_line_size = 1.0f},
+    };
+    const Turtle<TestType> turtle(draw_rules, {0.5f, 9.5f});
+
+    GridEnvironment environment({0.0f, 0.0f}, 1.0f, 1, 10, 1.0f);
+    environment.AddObstacle({0.0f, 0.0f}, {1.0f, 5.0f});
+
+    OpenLSystemInterpreter<TestType> open_lsystem(lsystem, turtle, "?E", environment,
+        [](float value) { return value > 0.0f ? TestType("X") : TestType("?E"); });
+
+    std::vector<TestType> state;
+    for (int i = 0; i < 10; i++) {
+        state = open_lsystem();
+    }
+
+    // Started at 9.5, obstacle covers 0 to 5, so only 4 lines fit
+    CHECK(std::count(state.begin(), state.end(), "F") == 4);
+    CHECK(state.back() == "X");
+}
+
+TEST_CASE("3D turtle matches the 2D turtle in the xy plane") {
+    using TestType = char;
+
+    const std::vector<DrawRuleStruct<TestType>> draw_rules{
+        DrawRuleStruct<TestType>{.symbolType = 'F', .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = '+', .turn_angle = 0.5f},
+        DrawRuleStruct<TestType>{.symbolType = '[', .push_fifo = true},
+        DrawRuleStruct<TestType>{.symbolType = ']', .pop_fifo = true},
+    };
+    const std::vector<TestType> input{'F', '[', '+', 'F', ']', '+', '+', 'F', 'F'};
+
+    std::vector<TurtleVector> starts;
+    Turtle<TestType>(draw_rules, {0.0f, 0.0f}).Interpret(input, 2.0f, [&starts](const TurtleVector& start, const TurtleVector&) {
+        starts.push_back(start);
+    });
+
+    std::vector<CylinderInstance> instances;
+    Turtle3D<TestType>(draw_rules, {0.0f, 0.0f, 0.0f}, 0.1f).Interpret(input, 2.0f, instances);
+
+    REQUIRE(instances.size() == starts.size());
+    for (std::size_t i = 0; i < starts.size(); i++) {
+        CHECK(instances[i].position.x == Approx(starts[i].x).margin(1e-5));
+        CHECK(instances[i].position.y == Approx(-starts[i].y).margin(1e-5));
+        CHECK(instances[i].position.z == Approx(0.0f).margin(1e-5));
+        CHECK(instances[i].length == Approx(2.0f));
+    }
+}
+
+TEST_CASE("3D turtle pitch, roll and taper") {
+    using TestType = char;
+
+    const std::vector<DrawRuleStruct<TestType>> draw_rules{
+        DrawRuleStruct<TestType>{.symbolType = 'F', .draw_line_size = 1.0f},
+        DrawRuleStruct<TestType>{.symbolType = '&', .pitch_angle = 3.14159265f / 2},
+        DrawRuleStruct<TestType>{.symbolType = '/', .roll_angle = 3.14159265f / 2},
+        DrawRuleStruct<TestType>{.symbolType = '!', .radius_scale = 0.5f},
+    };
+    std::vector<CylinderInstance> instances;
+    Turtle3D<TestType>(draw_rules, {0.0f, 0.0f, 0.0f}, 1.0f).Interpret({'F', '&', '!', 'F', '/', 'F'}, 1.0f, instances);
+
+    REQUIRE(instances.size() == 3);
+    // Pitching around the left axis turns the heading down, into -z
+    CHECK(instances[2].position.y == Approx(1.0f));
+    CHECK(instances[2].position.z == Approx(-1.0f));
+    // Rolling doesn't change the heading
+    float matrix[16];
+    instances[2].ToMatrix(matrix);
+    CHECK(matrix[4] == Approx(0.0f).margin(1e-5));
+    CHECK(matrix[6] == Approx(-1.0f));
+    CHECK(instances[1].radius == Approx(0.5f));
+    CHECK(instances[2].radius == Approx(0.5f));
+}
+
+TEST_CASE("Cylinder instances survive a round trip to disk") {
+    const std::vector<CylinderInstance> instances{
+        {{1.0f, 2.0f, 3.0f}, TurtleQuaternion::FromAxisAngle({0.0f, 0.0f, 1.0f}, 0.3f), 4.0f, 0.5f},
+        {{-1.0f, 0.0f, 7.0f}, {}, 1.0f, 0.25f},
+    };
+    const std::string path = "cylinder_instances_test.bin";
+    WriteCylinderInstances(path, instances);
+    const auto loaded = ReadCylinderInstances(path);
+
+    // A broken count is caught before anything is allocated
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        const std::uint64_t huge_count = std::uint64_t{1} << 60;
+        file.seekp(8);
+        file.write(reinterpret_cast<const char*>(&huge_count), sizeof(huge_count));
+    }
+    CHECK_THROWS_AS(ReadCylinderInstances(path), std::runtime_error);
+    std::remove(path.c_str());
+
+    REQUIRE(loaded.size() == 2);
+    CHECK(loaded[0].rotation.z == instances[0].rotation.z);
+    CHECK(loaded[1].position.z == 7.0f);
+    CHECK(loaded[1].radius == 0.25f);
+}
+
+TEST_CASE("Views fit bounds and zoom around a point") {
+    TurtleBounds bounds;
+    bounds.Add(TurtleVector{-10.0f, -40.0f});
+    bounds.Add(TurtleVector{10.0f, 0.0f});
+
+    const TurtleView fitted = FitView(bounds, 800.0f, 450.0f, 25.0f);
+    CHECK(fitted.scale == Approx(10.0f));
+    CHECK(fitted.ToScreen({0.0f, -20.0f}).x == Approx(400.0f));
+    CHECK(fitted.ToScreen({0.0f, -20.0f}).y == Approx(225.0f));
+
+    const TurtleView zoomed = fitted.ZoomedAt({100.0f, 50.0f}, 4.0f);
+    CHECK(zoomed.scale == Approx(40.0f));
+    const TurtleVector fixed = zoomed.ToScreen(fitted.ToTurtle({100.0f, 50.0f}));
+    CHECK(fixed.x == Approx(100.0f));
+    CHECK(fixed.y == Approx(50.0f));
+
+    const TurtleBounds visible = zoomed.Visible(800.0f, 450.0f);
+    CHECK(visible.Width() == Approx(20.0f));
+    CHECK(! visible.Intersects(TurtleBounds{}));
+}
+
+TEST_CASE("Collinear segments become polylines") {
+    SegmentBuffer segments;
+    // A trunk of 4 collinear pieces, then a bend, then a branch that starts elsewhere
+    for (int i = 0; i < 4; i++) {
+        segments.Add({0.0f, -static_cast<float>(i)}, {0.0f, -static_cast<float>(i + 1)});
+    }
+    segments.Add({0.0f, -4.0f}, {1.0f, -5.0f});
+    segments.Add({0.0f, -2.0f}, {-1.0f, -3.0f});
+    // Sub-tolerance wiggle on the branch and a branch too small to see
+    segments.Add({-1.0f, -3.0f}, {-1.001f, -3.0f});
+    segments.Add({5.0f, 5.0f}, {5.001f, 5.0f});
+
+    const PolylineBuffer polylines = SimplifySegments(segments, 0.01f);
+    REQUIRE(polylines.Size() == 2);
+    CHECK(polylines.begin[1] - polylines.begin[0] == 3);
+    CHECK(polylines.Point(1).y == Approx(-4.0f));
+    CHECK(polylines.Point(2).x == Approx(1.0f));
+    // The branch still ends on its exact last point
+    CHECK(polylines.Point(polylines.PointCount() - 1).x == Approx(-1.001f));
+    CHECK(polylines.SegmentCount() == 3);
+
+    // A tree of the visualiser, trunks are chains of 1 -> 1 1
+    LSystemInterpreter<std::string> lsystem({"0"}, {
+        Production<std::string>("1", {"1", "1"}),
+        Production<std::string>("0", {"1", "[", "0", "]", "0"}),
+    }, {"0", "1", "[", "]"});
+    const Turtle<std::string> turtle({
+        DrawRuleStruct<std::string>{.symbolType = "0", .draw_line_size = 1.0f, .end_this_branch = true},
+        DrawRuleStruct<std::string>{.symbolType = "1", .draw_line_size = 1.0f},
+        DrawRuleStruct<std::string>{.symbolType = "[", .turn_angle = -0.785398f, .push_fifo = true},
+        DrawRuleStruct<std::string>{.symbolType = "]", .turn_angle = 0.785398f, .pop_fifo = true},
+    }, {0.0f, 0.0f});
+    std::vector<std::string> state;
+    for (int generation = 0; generation < 10; generation++) {
+        state = lsystem();
+    }
+    SegmentBuffer tree;
+    turtle.Interpret(state, 1.0f, [&tree](const TurtleVector& start, const TurtleVector& end) { tree.Add(start, end); });
+    const PolylineBuffer simplified = SimplifySegments(tree, 1e-3f);
+    // Every trunk between two branch points becomes one piece
+    CHECK(simplified.SegmentCount() * 2 < tree.Size());
+}
+
+TEST_CASE("Simplified curves stay within the tolerance") {
+    // Gentle arc, every single turn is far below the tolerance but they add up
+    SegmentBuffer arc;
+    const float radius = 100.0f;
+    const std::size_t count = 2000;
+    const auto point = [radius, count](const std::size_t i) {
+        const float angle = 1.5f * static_cast<float>(i) / static_cast<float>(count);
+        return TurtleVector{radius * std::cos(angle), radius * std::sin(angle)};
+    };
+    for (std::size_t i = 0; i < count; i++) {
+        arc.Add(point(i), point(i + 1));
+    }
+
+    const float tolerance = 0.5f;
+    const PolylineBuffer polylines = SimplifySegments(arc, tolerance);
+    REQUIRE(polylines.Size() == 1);
+    CHECK(polylines.PointCount() > 2);
+    CHECK(polylines.PointCount() < count / 10);
+    const SegmentBuffer pieces = PolylinePieces(polylines);
+    for (std::size_t i = 0; i <= count; i++) {
+        const TurtleVector p = point(i);
+        float distance = INFINITY;
+        for (std::size_t piece = 0; piece < pieces.Size(); piece++) {
+            const TurtleVector a = pieces.Start(piece);
+            const TurtleVector b = pieces.End(piece);
+            const float length_squared = (b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y);
+            const float t = std::clamp(((p.x - a.x) * (b.x - a.x) + (p.y - a.y) * (b.y - a.y)) / length_squared, 0.0f, 1.0f);
+            distance = std::min(distance, std::hypot(a.x + t * (b.x - a.x) - p.x, a.y + t * (b.y - a.y) - p.y));
+        }
+        CHECK(distance <= tolerance * 1.001f);
+    }
+}